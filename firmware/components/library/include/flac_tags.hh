@@ -0,0 +1,182 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_FLAC_TAGS
+#define LIBRARY_FLAC_TAGS
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <strings.h>
+
+/**
+* @name flac tags
+*
+* @brief The STREAMINFO and VORBIS_COMMENT metadata blocks of a FLAC file, read without decoding:
+*        plain C++, shared by the player and the host tools.
+*/
+
+
+namespace library {
+
+struct flac_tags {
+	uint32_t sample_rate;
+	uint8_t channel_count;
+	uint8_t sample_bit_size;
+	uint64_t sample_count;
+	uint16_t track_number;
+	std::string artist;
+	std::string album;
+	std::string title;
+};
+
+
+namespace detail {
+
+static constexpr const size_t tag_max_size = 255;  // longer values are cut
+
+inline uint32_t read_be(std::istream &in, size_t size)
+{
+	auto value = uint32_t{0};
+	for (size_t i = 0; i < size; ++i)
+		value = value << 8 | (uint8_t)in.get();
+
+	return value;
+}
+
+inline uint32_t read_le32(std::istream &in)
+{
+	auto value = uint32_t{0};
+	for (size_t i = 0; i < 4; ++i)
+		value |= (uint32_t)(uint8_t)in.get() << (8 * i);
+
+	return value;
+}
+
+inline bool read_streaminfo(std::istream &in, flac_tags &tags)
+{
+	uint8_t data[18];
+	if (!in.read((char *)data, sizeof(data)))
+		return false;
+
+	// 16 bit min/max block size, 24 bit min/max frame size, then 20 bit rate, 3 bit channels - 1,
+	// 5 bit sample size - 1, 36 bit sample count
+	tags.sample_rate = (uint32_t)data[10] << 12 | (uint32_t)data[11] << 4 | data[12] >> 4;
+	tags.channel_count = ((data[12] >> 1) & 0x07) + 1;
+	tags.sample_bit_size = ((data[12] & 0x01) << 4 | data[13] >> 4) + 1;
+	tags.sample_count = (uint64_t)(data[13] & 0x0f) << 32 | (uint32_t)data[14] << 24 | (uint32_t)data[15] << 16
+						| (uint32_t)data[16] << 8 | data[17];
+
+	return true;
+}
+
+// consumes exactly size bytes of the block, whatever its content
+inline void read_vorbis_comment(std::istream &in, uint32_t size, flac_tags &tags)
+{
+	auto remaining = size;
+	auto take = [&in, &remaining] (uint32_t count) {
+		count = std::min(count, remaining);
+		remaining -= count;
+
+		return count;
+	};
+
+	auto album_artist = std::string{};
+	if (take(4) == 4)
+		in.ignore(take(read_le32(in)));  // vendor string
+	auto count = (take(4) == 4)? read_le32(in) : 0;
+	for (uint32_t i = 0; (i < count) && (remaining >= 4) && in; ++i) {
+		take(4);
+		auto comment_size = take(read_le32(in));
+		auto comment = std::string(std::min<size_t>(comment_size, tag_max_size), '\0');
+		in.read(comment.data(), comment.size());
+		in.ignore(comment_size - comment.size());
+
+		auto pos = comment.find('=');
+		if (pos == std::string::npos)
+			continue;
+		auto key = std::string_view{comment}.substr(0, pos);
+		auto value = comment.substr(pos + 1);
+
+		auto is = [&key] (const char *name) {
+			return (key.size() == strlen(name)) && (strncasecmp(key.data(), name, key.size()) == 0);
+		};
+		if (is("ARTIST"))
+			tags.artist = value;
+		else if (is("ALBUMARTIST") || is("ALBUM ARTIST"))
+			album_artist = value;
+		else if (is("ALBUM"))
+			tags.album = value;
+		else if (is("TITLE"))
+			tags.title = value;
+		else if (is("TRACKNUMBER"))
+			tags.track_number = (uint16_t)atoi(value.c_str());  // also "3/12"
+	}
+	in.ignore(remaining);
+
+	// albums are grouped under their album artist, when given
+	if (!album_artist.empty())
+		tags.artist = album_artist;
+}
+
+};  // namespace detail
+
+
+/**
+* @brief Reads the tags of the FLAC stream. False when it is no FLAC stream or has no STREAMINFO;
+*        missing text tags are left empty.
+*/
+inline bool read_flac_tags(std::istream &in, flac_tags &tags)
+{
+	static constexpr const uint8_t streaminfo_type = 0;
+	static constexpr const uint8_t vorbis_comment_type = 4;
+
+	tags = flac_tags{};
+
+	char marker[4];
+	if (!in.read(marker, sizeof(marker)) || (std::string_view{marker, 4} != "fLaC"))
+		return false;
+
+	// stops at the comment block, rather than skip through the pictures that tend to follow it
+	auto has_streaminfo = false;
+	auto has_comment = false;
+	for (auto last = false; !last && !(has_streaminfo && has_comment) && in; ) {
+		auto header = detail::read_be(in, 4);
+		last = (header & 0x80000000);
+		auto type = (uint8_t)((header >> 24) & 0x7f);
+		auto size = header & 0x00ffffff;
+
+		if ((type == streaminfo_type) && (size >= 18)) {
+			has_streaminfo = detail::read_streaminfo(in, tags);
+			in.ignore(size - 18);
+		} else if (type == vorbis_comment_type) {
+			detail::read_vorbis_comment(in, size, tags);
+			has_comment = true;
+		} else {
+			in.ignore(size);
+		}
+	}
+
+	return has_streaminfo && (tags.sample_rate != 0);
+}
+
+};  // namespace library
+
+#endif // LIBRARY_FLAC_TAGS
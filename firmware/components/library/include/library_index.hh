@@ -0,0 +1,468 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_INDEX
+#define LIBRARY_INDEX
+
+#include <stdio.h>
+#include <bit>
+#include <cstdint>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include "flac_tags.hh"
+
+/**
+* @name library index
+*
+* @brief The music library index file: artists, albums and tracks in sorted tables, read in place.
+*
+* Layout, all integers little endian:
+*   index_header
+*   artist_record[artist_count]  sorted by name
+*   album_record[album_count]    sorted by artist, then name
+*   track_record[track_count]    sorted by album, then track number, then path
+*   strings                      NUL terminated, referenced by offset from the start of the table
+* An artist's albums and an album's tracks are contiguous ranges of the next table. Names compare
+* ASCII case-insensitively. Plain C++: the player and the host tools share it.
+*/
+
+
+namespace library {
+
+static_assert(std::endian::native == std::endian::little, "library_index: the index file is little endian");
+
+static constexpr const uint32_t index_magic = 0x42494c50;  // "PLIB"
+static constexpr const uint32_t index_version = 1;
+
+struct index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t artist_count;
+	uint32_t album_count;
+	uint32_t track_count;
+	uint32_t artists_offset;
+	uint32_t albums_offset;
+	uint32_t tracks_offset;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+};
+
+struct artist_record {
+	uint32_t name;
+	uint32_t first_album;
+	uint32_t album_count;
+};
+
+struct album_record {
+	uint32_t name;
+	uint32_t artist;
+	uint32_t first_track;
+	uint32_t track_count;
+};
+
+struct track_record {
+	uint32_t path;         // from the card root, as played
+	uint32_t title;
+	uint32_t album;
+	uint32_t sample_rate;
+	uint32_t seconds;
+	uint16_t number;
+	uint8_t channel_count;
+	uint8_t sample_bit_size;
+};
+
+
+inline int compare_names(std::string_view a, std::string_view b)
+{
+	auto size = std::min(a.size(), b.size());
+	for (size_t i = 0; i < size; ++i) {
+		auto ca = (unsigned char)tolower((unsigned char)a[i]);
+		auto cb = (unsigned char)tolower((unsigned char)b[i]);
+		if (ca != cb)
+			return (ca < cb)? -1 : 1;
+	}
+
+	return (a.size() == b.size())? 0 : (a.size() < b.size())? -1 : 1;
+}
+
+struct name_less {
+	using is_transparent = void;
+
+	bool operator()(std::string_view a, std::string_view b) const
+	{
+		return compare_names(a, b) < 0;
+	}
+};
+
+inline bool contains_name(std::string_view text, std::string_view part)
+{
+	if (part.size() > text.size())
+		return false;
+	for (size_t i = 0; i + part.size() <= text.size(); ++i) {
+		if (compare_names(text.substr(i, part.size()), part) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+/**
+* @brief Collects the tracks and writes the index file.
+*
+* Track titles and paths are stored once each, artist and album names once per distinct name (as
+* compared), so that equal offsets mean equal names.
+*/
+class index_builder {
+public:
+	index_builder()
+		: _strings{}, _names{}, _tracks{}
+	{}
+	index_builder(const index_builder&) = delete;
+	index_builder(index_builder&& other) = delete;
+
+	index_builder& operator=(const index_builder&) = delete;
+	index_builder& operator=(index_builder&& other) = delete;
+
+	size_t size() const
+	{
+		return _tracks.size();
+	}
+
+	/**
+	* @brief Adds the track at path; untagged tracks go under "Unknown artist", the directory name
+	*        as album and the file name as title.
+	*/
+	void add(std::string_view path, const flac_tags &tags)
+	{
+		auto slash = path.rfind('/');
+		auto file = (slash == std::string_view::npos)? path : path.substr(slash + 1);
+		auto dir = (slash == std::string_view::npos)? std::string_view{} : path.substr(0, slash);
+		auto dir_slash = dir.rfind('/');
+		auto dir_name = (dir_slash == std::string_view::npos)? dir : dir.substr(dir_slash + 1);
+
+		auto entry = track_entry{};
+		entry.path = _add_string(path);
+		entry.title = _add_string(tags.title.empty()? file : std::string_view{tags.title});
+		entry.artist = _add_name(tags.artist.empty()? "Unknown artist" : std::string_view{tags.artist});
+		entry.album = _add_name(tags.album.empty()? dir_name : std::string_view{tags.album});
+		entry.sample_rate = tags.sample_rate;
+		entry.seconds = tags.sample_rate? (uint32_t)(tags.sample_count / tags.sample_rate) : 0;
+		entry.number = tags.track_number;
+		entry.channel_count = tags.channel_count;
+		entry.sample_bit_size = tags.sample_bit_size;
+		_tracks.push_back(entry);
+	}
+
+	void write(FILE *file)
+	{
+		auto less = [this] (uint32_t a, uint32_t b) { return compare_names(_string(a), _string(b)) < 0; };
+
+		// artists, by name; albums, by artist then name; tracks, by album, number, then path
+		std::sort(_tracks.begin(), _tracks.end(), [this, &less] (const track_entry &a, const track_entry &b) {
+			if (a.artist != b.artist)
+				return less(a.artist, b.artist);
+			if (a.album != b.album)
+				return less(a.album, b.album);
+			if (a.number != b.number)
+				return a.number < b.number;
+
+			return compare_names(_string(a.path), _string(b.path)) < 0;
+		});
+
+		std::vector<artist_record> artists{};
+		std::vector<album_record> albums{};
+		std::vector<track_record> tracks{};
+		tracks.reserve(_tracks.size());
+		for (size_t i = 0; i < _tracks.size(); ++i) {
+			auto &entry = _tracks[i];
+			if (artists.empty() || (artists.back().name != entry.artist)) {
+				artists.push_back({entry.artist, (uint32_t)albums.size(), 0});
+				albums.push_back({entry.album, (uint32_t)artists.size() - 1, (uint32_t)i, 0});
+				++artists.back().album_count;
+			} else if (albums.back().name != entry.album) {
+				albums.push_back({entry.album, (uint32_t)artists.size() - 1, (uint32_t)i, 0});
+				++artists.back().album_count;
+			}
+			++albums.back().track_count;
+
+			tracks.push_back({entry.path, entry.title, (uint32_t)albums.size() - 1, entry.sample_rate, entry.seconds,
+								entry.number, entry.channel_count, entry.sample_bit_size});
+		}
+
+		auto header = index_header{};
+		header.magic = index_magic;
+		header.version = index_version;
+		header.artist_count = artists.size();
+		header.album_count = albums.size();
+		header.track_count = tracks.size();
+		header.artists_offset = sizeof(index_header);
+		header.albums_offset = header.artists_offset + artists.size() * sizeof(artist_record);
+		header.tracks_offset = header.albums_offset + albums.size() * sizeof(album_record);
+		header.strings_offset = header.tracks_offset + tracks.size() * sizeof(track_record);
+		header.strings_size = _strings.size();
+
+		_write(file, &header, sizeof(header));
+		_write(file, artists.data(), artists.size() * sizeof(artist_record));
+		_write(file, albums.data(), albums.size() * sizeof(album_record));
+		_write(file, tracks.data(), tracks.size() * sizeof(track_record));
+		_write(file, _strings.data(), _strings.size());
+	}
+
+private:
+	struct track_entry {
+		uint32_t path;
+		uint32_t title;
+		uint32_t artist;
+		uint32_t album;
+		uint32_t sample_rate;
+		uint32_t seconds;
+		uint16_t number;
+		uint8_t channel_count;
+		uint8_t sample_bit_size;
+	};
+
+	std::string _strings;
+	std::map<std::string, uint32_t, name_less> _names;  // the artist and album names stored so far
+	std::vector<track_entry> _tracks;
+
+	inline std::string_view _string(uint32_t offset) const
+	{
+		return std::string_view{_strings.c_str() + offset};
+	}
+
+	uint32_t _add_string(std::string_view value)
+	{
+		auto offset = (uint32_t)_strings.size();
+		_strings.append(value.substr(0, value.find('\0')));
+		_strings.push_back('\0');
+
+		return offset;
+	}
+
+	uint32_t _add_name(std::string_view value)
+	{
+		auto it = _names.find(value);
+		if (it != _names.end())
+			return it->second;
+
+		auto offset = _add_string(value);
+		_names.emplace(value, offset);
+
+		return offset;
+	}
+
+	static void _write(FILE *file, const void *data, size_t size)
+	{
+		if ((size != 0) && (::fwrite(data, 1, size, file) != size))
+			throw std::runtime_error("index_builder: write failure");
+	}
+};
+
+
+/**
+* @brief Reads the index file in place: every lookup seeks to and reads the few records it needs.
+*/
+class index_reader {
+public:
+	explicit index_reader(const char *path)
+		: _file{::fopen(path, "rb")}, _header{}
+	{
+		if (_file == nullptr)
+			throw std::runtime_error("index_reader: no index");
+
+		if ((::fread(&_header, sizeof(_header), 1, _file) != 1) || (_header.magic != index_magic)
+				|| (_header.version != index_version)) {
+			::fclose(_file);
+			throw std::runtime_error("index_reader: bad index");
+		}
+	}
+	index_reader(const index_reader&) = delete;
+	index_reader(index_reader&& other) = delete;
+
+	index_reader& operator=(const index_reader&) = delete;
+	index_reader& operator=(index_reader&& other) = delete;
+
+	~index_reader()
+	{
+		::fclose(_file);
+	}
+
+	const index_header &header() const
+	{
+		return _header;
+	}
+
+	artist_record artist(uint32_t index)
+	{
+		return _record<artist_record>(_header.artists_offset, index, _header.artist_count);
+	}
+
+	album_record album(uint32_t index)
+	{
+		return _record<album_record>(_header.albums_offset, index, _header.album_count);
+	}
+
+	track_record track(uint32_t index)
+	{
+		return _record<track_record>(_header.tracks_offset, index, _header.track_count);
+	}
+
+	// read in chunks up to its NUL, however long; card paths can exceed a chunk
+	std::string string(uint32_t offset)
+	{
+		if (offset >= _header.strings_size)
+			throw std::runtime_error("index_reader: bad string");
+
+		std::string value{};
+		char data[_string_chunk_size];
+		_seek(_header.strings_offset + offset);
+		while (offset < _header.strings_size) {
+			auto size = ::fread(data, 1, std::min<size_t>(sizeof(data), _header.strings_size - offset), _file);
+			if (size == 0)
+				throw std::runtime_error("index_reader: bad string");
+
+			auto length = strnlen(data, size);
+			value.append(data, length);
+			if (length < size)
+				return value;
+			offset += size;
+		}
+
+		throw std::runtime_error("index_reader: bad string");
+	}
+
+	/**
+	* @brief The artist of the name, by binary search.
+	*/
+	std::optional<uint32_t> find_artist(std::string_view name)
+	{
+		uint32_t low = 0;
+		uint32_t high = _header.artist_count;
+		while (low < high) {
+			auto middle = low + (high - low) / 2;
+			auto order = compare_names(string(artist(middle).name), name);
+			if (order == 0)
+				return middle;
+			if (order < 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		return std::nullopt;
+	}
+
+	/**
+	* @brief Up to limit tracks whose title, album or artist contains the text, in index order.
+	*
+	* Three sequential passes: over the strings, collecting the matching ones, then over the albums
+	* and over the tracks.
+	*/
+	std::vector<uint32_t> search(std::string_view text, size_t limit)
+	{
+		std::vector<uint32_t> matches{};
+		_seek(_header.strings_offset);
+		std::string value{};
+		for (uint32_t offset = 0, start = 0; offset < _header.strings_size; ++offset) {
+			auto c = ::fgetc(_file);
+			if (c == EOF)
+				break;
+			if (c != '\0') {
+				value.push_back((char)c);
+				continue;
+			}
+
+			if (contains_name(value, text))
+				matches.push_back(start);
+			value.clear();
+			start = offset + 1;
+		}
+		auto matching = [&matches] (uint32_t offset) {
+			return std::binary_search(matches.begin(), matches.end(), offset);
+		};
+
+		std::vector<bool> albums(_header.album_count);
+		_for_each<album_record>(_header.albums_offset, _header.album_count, [&] (uint32_t i, const album_record &album) {
+			albums[i] = matching(album.name);
+		});
+		_for_each<artist_record>(_header.artists_offset, _header.artist_count, [&] (uint32_t, const artist_record &artist) {
+			if (matching(artist.name))
+				std::fill_n(albums.begin() + artist.first_album, artist.album_count, true);
+		});
+
+		std::vector<uint32_t> tracks{};
+		_for_each<track_record>(_header.tracks_offset, _header.track_count, [&] (uint32_t i, const track_record &track) {
+			if ((tracks.size() < limit) && (albums[track.album] || matching(track.title)))
+				tracks.push_back(i);
+		});
+
+		return tracks;
+	}
+
+private:
+	static constexpr const size_t _batch_size = 16;  // records per read of a sequential pass
+	static constexpr const size_t _string_chunk_size = 256;
+
+	FILE *_file;
+	index_header _header;
+
+	void _seek(uint32_t offset)
+	{
+		if (::fseek(_file, offset, SEEK_SET) != 0)
+			throw std::runtime_error("index_reader: seek failure");
+	}
+
+	template<typename RECORD>
+	RECORD _record(uint32_t table_offset, uint32_t index, uint32_t count)
+	{
+		if (index >= count)
+			throw std::runtime_error("index_reader: bad index");
+
+		RECORD record{};
+		_seek(table_offset + index * sizeof(RECORD));
+		if (::fread(&record, sizeof(RECORD), 1, _file) != 1)
+			throw std::runtime_error("index_reader: read failure");
+
+		return record;
+	}
+
+	template<typename RECORD, typename FUNCTION>
+	void _for_each(uint32_t table_offset, uint32_t count, FUNCTION function)
+	{
+		RECORD records[_batch_size];
+		_seek(table_offset);
+		for (uint32_t i = 0; i < count; ) {
+			auto batch = std::min<size_t>(_batch_size, count - i);
+			if (::fread(records, sizeof(RECORD), batch, _file) != batch)
+				throw std::runtime_error("index_reader: read failure");
+
+			for (size_t j = 0; j < batch; ++j, ++i)
+				function(i, records[j]);
+		}
+	}
+};
+
+};  // namespace library
+
+#endif // LIBRARY_INDEX
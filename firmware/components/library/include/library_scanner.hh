@@ -0,0 +1,259 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_SCANNER
+#define LIBRARY_SCANNER
+
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <iostream>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <basics/file.hh>
+#include "library_index.hh"
+#include "wav_tags.hh"
+
+/**
+* @name library scanner
+*
+* @brief Background scan of the card into the library index file.
+*/
+
+
+namespace library {
+
+enum class scan_state: uint8_t {
+	idle,
+	scanning,
+	done,
+	failed,
+};
+
+
+/**
+* @brief Walks the card from its root on a low priority task, reads the tags of the FLAC and WAVE
+*        files and writes the index file.
+*
+* The catalogue is collected in RAM, so a scan stops at max_tracks (and reports so): larger
+* libraries are indexed on a computer, with the library_index host tool. The index is written
+* aside, then moved in place under the index lock, which readers hold while they read.
+*/
+class scanner {
+public:
+	static constexpr const char *index_name = "/.library.idx";
+
+	scanner(const std::string &mount_point, size_t max_tracks, UBaseType_t priority, BaseType_t core)
+		: _mount_point{mount_point}, _max_tracks{max_tracks}, _priority{priority}, _core{core},
+		  _state{scan_state::idle}, _count{0}, _truncated{false}, _cancel{false}, _stopped{xSemaphoreCreateBinary()},
+		  _lock{}
+	{
+		if (_stopped == nullptr)
+			throw std::runtime_error("library_scanner: semaphore allocation failure");
+		xSemaphoreGive(_stopped);  // taken while a scan runs
+	}
+	scanner(const scanner&) = delete;
+	scanner(scanner&& other) = delete;
+
+	scanner& operator=(const scanner&) = delete;
+	scanner& operator=(scanner&& other) = delete;
+
+	~scanner()
+	{
+		stop();
+		vSemaphoreDelete(_stopped);
+	}
+
+	std::string index_path() const
+	{
+		return _mount_point + index_name;
+	}
+
+	// held while reading the index file
+	std::mutex &lock()
+	{
+		return _lock;
+	}
+
+	scan_state state() const
+	{
+		return _state.load(std::memory_order_relaxed);
+	}
+
+	// tracks read so far, or in the last scan
+	size_t count() const
+	{
+		return _count.load(std::memory_order_relaxed);
+	}
+
+	bool truncated() const
+	{
+		return _truncated.load(std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief Starts a scan; false when one is running.
+	*/
+	bool start()
+	{
+		if (xSemaphoreTake(_stopped, 0) != pdTRUE)
+			return false;
+
+		_cancel = false;
+		_count = 0;
+		_truncated = false;
+		_state = scan_state::scanning;
+		if (xTaskCreatePinnedToCore(&scanner::_scan, "library_scan", _stack_size, this, _priority, nullptr, _core) != pdPASS) {
+			_state = scan_state::failed;
+			xSemaphoreGive(_stopped);
+
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	* @brief Cancels the running scan, if any, and waits for it to end: before the card unmount.
+	*/
+	void stop()
+	{
+		_cancel = true;
+		xSemaphoreTake(_stopped, portMAX_DELAY);
+		xSemaphoreGive(_stopped);
+	}
+
+private:
+	static constexpr const uint32_t _stack_size = 6144;
+	static constexpr const size_t _depth_max = 8;
+
+	std::string _mount_point;
+	size_t _max_tracks;
+	UBaseType_t _priority;
+	BaseType_t _core;
+	std::atomic<scan_state> _state;
+	std::atomic<size_t> _count;
+	std::atomic<bool> _truncated;
+	volatile bool _cancel;
+	SemaphoreHandle_t _stopped;
+	std::mutex _lock;
+
+	static void _scan(void *arg)
+	{
+		auto *self = (scanner *)arg;
+
+		try {
+			index_builder builder{};
+			self->_walk(builder, "", 0);
+			if (self->_cancel)
+				throw std::runtime_error("library_scanner: canceled");
+
+			self->_write(builder);
+			self->_state = scan_state::done;
+			std::cout << "library: indexed " << builder.size() << " tracks" << std::endl;
+		} catch (const std::exception &e) {
+			self->_state = scan_state::failed;
+			std::cerr << "library: scan failure: " << e.what() << std::endl;
+		}
+
+		xSemaphoreGive(self->_stopped);
+		vTaskDelete(nullptr);
+	}
+
+	void _walk(index_builder &builder, const std::string &dir, size_t depth)
+	{
+		auto dir_path = _mount_point + dir;
+		DIR *dp = ::opendir(dir_path.c_str());
+		if (dp == nullptr)
+			return;
+
+		struct dirent *ep = nullptr;
+		while (!_cancel && !_truncated) {
+			ep = ::readdir(dp);
+			if (ep == nullptr)
+				break;
+			if (ep->d_name[0] == '.')
+				continue;
+
+			auto path = dir + "/" + ep->d_name;
+			if (ep->d_type == DT_DIR) {
+				if (depth < _depth_max)
+					_walk(builder, path, depth + 1);
+
+				continue;
+			}
+
+			if (!is_track_file(ep->d_name))
+				continue;
+			if (builder.size() >= _max_tracks) {
+				_truncated = true;
+
+				break;
+			}
+
+			try {
+				basics::file::input<512> file_istream{(_mount_point + path).c_str()};
+				flac_tags tags{};
+				if (read_track_tags(file_istream, tags)) {
+					builder.add(path, tags);
+					_count.fetch_add(1, std::memory_order_relaxed);
+				}
+			} catch (...) {
+				// unreadable files are left out
+			}
+
+			taskYIELD();
+		}
+		::closedir(dp);
+	}
+
+	void _write(index_builder &builder)
+	{
+		auto temp_path = _mount_point + "/.library.tmp";
+		auto *file = ::fopen(temp_path.c_str(), "wb");
+		if (file == nullptr)
+			throw std::runtime_error("library_scanner: cannot write the index");
+
+		try {
+			builder.write(file);
+		} catch (...) {
+			::fclose(file);
+			::unlink(temp_path.c_str());
+			throw;
+		}
+
+		// the last writes fail on close, a truncated index must not replace the previous one
+		auto failed = (::ferror(file) != 0);
+		if ((::fclose(file) != 0) || failed) {
+			::unlink(temp_path.c_str());
+			throw std::runtime_error("library_scanner: cannot write the index");
+		}
+
+		// FAT renames onto no existing file
+		std::lock_guard<std::mutex> guard{_lock};
+		::unlink(index_path().c_str());
+		if (::rename(temp_path.c_str(), index_path().c_str()) != 0)
+			throw std::runtime_error("library_scanner: cannot replace the index");
+	}
+};
+
+};  // namespace library
+
+#endif // LIBRARY_SCANNER
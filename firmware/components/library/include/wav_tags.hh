@@ -0,0 +1,225 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_WAV_TAGS
+#define LIBRARY_WAV_TAGS
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <strings.h>
+#include "flac_tags.hh"
+
+/**
+* @name wav tags
+*
+* @brief The RIFF header of a PCM WAVE file: its format, where its data starts, and the LIST/INFO
+*        text ahead of the data. Plain C++, shared by the player and the host tools.
+*/
+
+
+namespace library {
+
+struct wav_format {
+	uint32_t sample_rate;
+	uint8_t channel_count;
+	uint8_t sample_bit_size;   // valid bits of a sample
+	uint8_t container_size;    // bytes a sample takes in the stream
+	uint16_t block_align;      // bytes a frame takes in the stream
+	uint64_t sample_count;     // frames; 0 when the data size is unknown
+	uint32_t data_offset;      // of the first frame, in the file
+	uint32_t data_size;        // UINT32_MAX when unknown
+};
+
+
+namespace detail {
+
+static constexpr const uint16_t wave_format_pcm = 0x0001;
+static constexpr const uint16_t wave_format_extensible = 0xfffe;
+
+inline bool read_fmt(std::istream &in, uint32_t size, wav_format &format)
+{
+	uint8_t data[26];
+	auto count = std::min<uint32_t>(size, sizeof(data));
+	if ((size < 16) || !in.read((char *)data, count))
+		return false;
+	in.ignore(size - count);
+
+	auto le16 = [&data] (size_t pos) {
+		return (uint16_t)(data[pos] | data[pos + 1] << 8);
+	};
+
+	// the extensible format carries the actual one as the first two bytes of its sub-format GUID
+	auto tag = le16(0);
+	if ((tag == wave_format_extensible) && (size >= 26))
+		tag = le16(24);
+	if (tag != wave_format_pcm)
+		return false;
+
+	format.channel_count = (uint8_t)le16(2);
+	format.sample_rate = le16(4) | (uint32_t)le16(6) << 16;
+	format.block_align = le16(12);
+	format.container_size = (uint8_t)(le16(14) / 8 + ((le16(14) % 8)? 1 : 0));
+	format.sample_bit_size = (uint8_t)le16(14);
+	if ((le16(0) == wave_format_extensible) && (size >= 20) && (le16(18) != 0))
+		format.sample_bit_size = (uint8_t)std::min<uint16_t>(le16(18), format.sample_bit_size);  // valid bits
+
+	return (format.channel_count != 0) && (format.sample_rate != 0) && (format.container_size >= 2)
+			&& (format.container_size <= 4) && (format.block_align == format.channel_count * format.container_size);
+}
+
+// consumes exactly size bytes of the chunk
+inline void read_info(std::istream &in, uint32_t size, flac_tags &tags)
+{
+	char type[4];
+	if ((size < 4) || !in.read(type, sizeof(type)) || (std::string_view{type, 4} != "INFO")) {
+		in.ignore(size - std::min<uint32_t>(size, 4));
+
+		return;
+	}
+
+	for (auto remaining = size - 4; (remaining >= 8) && in; ) {
+		char id[4];
+		in.read(id, sizeof(id));
+		auto text_size = read_le32(in);
+		auto padded_size = std::min(text_size + (text_size & 1), remaining - 8);
+		remaining -= 8 + padded_size;
+
+		auto text = std::string(std::min<size_t>(padded_size, tag_max_size), '\0');
+		in.read(text.data(), text.size());
+		in.ignore(padded_size - text.size());
+		text.resize(strnlen(text.c_str(), text.size()));
+
+		auto key = std::string_view{id, 4};
+		if (key == "IART")
+			tags.artist = text;
+		else if (key == "IPRD")
+			tags.album = text;
+		else if (key == "INAM")
+			tags.title = text;
+		else if ((key == "ITRK") || (key == "IPRT"))
+			tags.track_number = (uint16_t)atoi(text.c_str());
+	}
+}
+
+};  // namespace detail
+
+
+/**
+* @brief Reads the RIFF header of the stream up to the start of its data, the LIST/INFO tags on
+*        the way into tags, if given. False when it is no PCM WAVE stream.
+*/
+inline bool read_wav_header(std::istream &in, wav_format &format, flac_tags *tags = nullptr)
+{
+	format = wav_format{};
+
+	char marker[12];
+	if (!in.read(marker, sizeof(marker)) || (std::string_view{marker, 4} != "RIFF")
+			|| (std::string_view{marker + 8, 4} != "WAVE"))
+		return false;
+
+	auto pos = uint32_t{12};
+	auto has_format = false;
+	while (in) {
+		char id[4];
+		if (!in.read(id, sizeof(id)))
+			return false;
+		auto size = detail::read_le32(in);
+		pos += 8;
+
+		auto key = std::string_view{id, 4};
+		if (key == "data") {
+			if (!has_format)
+				return false;
+
+			format.data_offset = pos;
+			format.data_size = size;
+			if ((size != 0) && (size != UINT32_MAX))
+				format.sample_count = size / format.block_align;
+			else
+				format.data_size = UINT32_MAX;  // a stream being written
+
+			return true;
+		}
+
+		if (key == "fmt ") {
+			if (!detail::read_fmt(in, size, format))
+				return false;
+			has_format = true;
+		} else if ((key == "LIST") && (tags != nullptr)) {
+			detail::read_info(in, size, *tags);
+		} else {
+			in.ignore(size);
+		}
+		in.ignore(size & 1);  // chunks are word aligned
+		pos += size + (size & 1);
+	}
+
+	return false;
+}
+
+
+/**
+* @brief Reads the tags of the WAVE stream: its format, and its LIST/INFO text when it comes
+*        ahead of the data.
+*/
+inline bool read_wav_tags(std::istream &in, flac_tags &tags)
+{
+	tags = flac_tags{};
+
+	wav_format format{};
+	if (!read_wav_header(in, format, &tags))
+		return false;
+
+	tags.sample_rate = format.sample_rate;
+	tags.channel_count = format.channel_count;
+	tags.sample_bit_size = format.sample_bit_size;
+	tags.sample_count = format.sample_count;
+
+	return true;
+}
+
+
+// the track files the library takes, by extension
+inline bool is_track_file(std::string_view name)
+{
+	auto is = [&name] (std::string_view extension) {
+		return (name.size() > extension.size())
+				&& (strncasecmp(name.data() + name.size() - extension.size(), extension.data(), extension.size()) == 0);
+	};
+
+	return is(".flac") || is(".wav");
+}
+
+
+/**
+* @brief Reads the tags of a FLAC or a WAVE stream, by its first byte.
+*/
+inline bool read_track_tags(std::istream &in, flac_tags &tags)
+{
+	if (in.peek() == 'R')
+		return read_wav_tags(in, tags);
+
+	return read_flac_tags(in, tags);
+}
+
+};  // namespace library
+
+#endif // LIBRARY_WAV_TAGS
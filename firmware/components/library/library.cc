@@ -0,0 +1,20 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "library_index.hh"
+#include "library_scanner.hh"
+#include "wav_tags.hh"
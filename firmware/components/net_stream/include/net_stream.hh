@@ -0,0 +1,418 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NET_STREAM
+#define NET_STREAM
+
+#include <stdio.h>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <streambuf>
+#include <stdexcept>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include <basics/error.hh>
+
+/**
+* @name net_stream
+*
+* @brief Network stream input: a receiver task streams a TCP connection into a jitter buffer of
+*        blocks ahead of the consumer, which reads through a std::istream.
+*/
+
+
+/**
+* @brief Receiver and jitter buffer counters, written by the receiver task and the consumer,
+*        readable from any task.
+*/
+struct net_stream_stats {
+	std::atomic<uint32_t> fill{0};            // bytes received ahead of the consumer
+	std::atomic<uint32_t> target{0};          // the fill aimed at, bytes
+	std::atomic<uint32_t> byte_rate{0};       // arrival rate, bytes/second
+	std::atomic<uint32_t> jitter_us{0};       // interarrival jitter
+	std::atomic<int32_t> drift_ppm{0};        // consumption rate correction, + for faster
+	std::atomic<uint32_t> byte_count{0};
+	std::atomic<uint32_t> underrun_count{0};  // consumer reads that found the buffer empty, and re-buffered
+	std::atomic<uint32_t> error_count{0};
+
+	void reset()
+	{
+		byte_count.store(0, std::memory_order_relaxed);
+		underrun_count.store(0, std::memory_order_relaxed);
+		error_count.store(0, std::memory_order_relaxed);
+	}
+};
+
+
+/**
+* @brief Ring of BLOCK_COUNT blocks of BLOCK_SIZE bytes, filled from a TCP stream by a receiver task.
+*
+* The ring works as the read_ahead_buffer's does: full blocks are handed over through a counting
+* semaphore and given back through another one once consumed, a short block ends the stream and
+* an empty one follows it. The connection is made by the constructor; the stream ends when the
+* server closes it, or sends nothing for receive_timeout_s.
+*
+* The jitter buffer primes, and re-primes after running empty, up to a target fill sized from the
+* arrivals: their rate, measured over rate_window_us windows, and their jitter, the RFC 3550 mean
+* deviation of the transit time from that of a steady stream at that rate. The target covers
+* jitter_factor times the jitter, and no less than a floor raised by each underrun.
+*
+* Sender and DAC clocks differ by some ppm, so the fill drifts away from the target over time;
+* instead of dropping or repeating samples, the consumer takes drift_ppm() as a correction of its
+* resampling ratio: a PI controller on the smoothed fill error, in seconds of stream, bounded so
+* that the pitch change stays inaudible.
+*/
+template<size_t BLOCK_SIZE, size_t BLOCK_COUNT>
+class net_stream_buffer : public std::streambuf {
+public:
+	static constexpr const size_t block_size = BLOCK_SIZE;
+	static constexpr const size_t block_count = BLOCK_COUNT;
+	static constexpr const size_t target_max = BLOCK_SIZE * BLOCK_COUNT * 3 / 4;  // room for the bursts
+
+	net_stream_buffer(net_stream_stats &stats, const char *host, uint16_t port, uint8_t core, UBaseType_t priority)
+		: _stats{stats}, _blocks{}, _sizes{}, _write_index{0}, _read_index{0}, _holding{false}, _eof{false},
+		  _primed{false}, _quit{false}, _done{false}, _socket{-1}, _filled{nullptr}, _free{nullptr},
+		  _idle{nullptr}, _task{nullptr}, _floor_us{_floor_min_us}, _rate{0}, _window_start{0}, _window_bytes{0},
+		  _base_time{0}, _base_bytes{0}, _total_bytes{0}, _transit{0}, _has_transit{false}, _jitter{0},
+		  _steer_us{0}, _fill{-1}, _integral{0}, _ppm{0}
+	{
+		_stats.fill.store(0, std::memory_order_relaxed);
+		_stats.target.store(target_max * 2 / 3, std::memory_order_relaxed);  // until the rate is known
+		_stats.byte_rate.store(0, std::memory_order_relaxed);
+		_stats.jitter_us.store(0, std::memory_order_relaxed);
+		_stats.drift_ppm.store(0, std::memory_order_relaxed);
+
+		try {
+			for (auto &block : _blocks) {
+				block = (char *)heap_caps_malloc(BLOCK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+				if (block == nullptr)
+					throw std::runtime_error("net_stream_buffer: buffer allocation failure");
+			}
+
+			_idle = xSemaphoreCreateBinary();
+			_filled = xSemaphoreCreateCounting(BLOCK_COUNT, 0);
+			_free = xSemaphoreCreateCounting(BLOCK_COUNT + 1, BLOCK_COUNT);  // + the wake up on close
+			if ((_idle == nullptr) || (_filled == nullptr) || (_free == nullptr))
+				throw std::runtime_error("net_stream_buffer: semaphore allocation failure");
+
+			_connect(host, port);
+
+			if (xTaskCreatePinnedToCore(&net_stream_buffer<BLOCK_SIZE, BLOCK_COUNT>::_receive, "net_stream", 3072,
+											this, priority, &_task, core) != pdPASS)
+				throw std::runtime_error("net_stream_buffer: task creation failure");
+		} catch (...) {
+			_release();
+			throw;
+		}
+	}
+	net_stream_buffer(const net_stream_buffer&) = delete;
+	net_stream_buffer(net_stream_buffer&& other) = delete;
+
+	net_stream_buffer& operator=(const net_stream_buffer&) = delete;
+	net_stream_buffer& operator=(net_stream_buffer&& other) = delete;
+
+	~net_stream_buffer()
+	{
+		// wakes the receiver up, wherever it waits
+		_quit = true;
+		::shutdown(_socket, SHUT_RDWR);
+		xSemaphoreGive(_free);
+		xSemaphoreTake(_idle, portMAX_DELAY);
+
+		_release();
+		_stats.fill.store(0, std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief The correction of the consumption rate, in ppm, that steers the fill to its target; the
+	*        consumer calls it as it starts on each decoded block.
+	*/
+	int32_t drift_ppm()
+	{
+		auto now = esp_timer_get_time();
+		auto elapsed = (now - _steer_us) / 1e6;
+		_steer_us = now;
+
+		auto rate = _stats.byte_rate.load(std::memory_order_relaxed);
+		if (!_primed || (rate == 0) || (elapsed > 1.0))
+			return _ppm;  // not yet, or back from a stall
+
+		auto fill = (double)_stats.fill.load(std::memory_order_relaxed);
+		_fill = (_fill < 0)? fill : _fill + (fill - _fill) / _fill_smoothing;
+		auto error = (_fill - _stats.target.load(std::memory_order_relaxed)) / rate;
+		_integral = std::clamp(_integral + _ki * error * elapsed, -_integral_max, _integral_max);
+		_ppm = (int32_t)std::clamp<double>(std::lround(_kp * error + _integral), -_ppm_max, _ppm_max);
+		_stats.drift_ppm.store(_ppm, std::memory_order_relaxed);
+
+		return _ppm;
+	}
+
+protected:
+	// bytes readable without blocking: what the receiver task has filled ahead of the get area
+	std::streamsize showmanyc() override
+	{
+		if (_eof)
+			return -1;
+
+		return uxSemaphoreGetCount(_filled) * BLOCK_SIZE;
+	}
+
+	int_type underflow() override
+	{
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		if (_eof || !_next_block())
+			return traits_type::eof();
+
+		return traits_type::to_int_type(*gptr());
+	}
+
+private:
+	static constexpr const int _receive_timeout_s = 3;
+	static constexpr const int64_t _rate_window_us = 1000000;
+	static constexpr const double _jitter_factor = 6;
+	static constexpr const uint32_t _floor_min_us = 100000;
+	static constexpr const uint32_t _floor_max_us = 2000000;
+	static constexpr const uint32_t _prime_poll_ms = 10;
+	static constexpr const double _fill_smoothing = 16;  // blocks
+	static constexpr const double _kp = 10000;           // ppm per second of fill error
+	static constexpr const double _ki = 25;              // ppm per second of fill error, per second
+	static constexpr const double _integral_max = 500;   // ppm, the clock offset it can take up
+	static constexpr const double _ppm_max = 1000;       // ~1.7 cents
+
+	net_stream_stats &_stats;
+	char *_blocks[BLOCK_COUNT];
+	size_t _sizes[BLOCK_COUNT];
+	size_t _write_index;                  // receiver task
+	size_t _read_index;                   // consumer
+	bool _holding;                        // the consumer holds the block at _read_index
+	bool _eof;
+	bool _primed;
+	volatile bool _quit;
+	std::atomic<bool> _done;              // the receiver handed over the end of the stream
+	int _socket;
+	SemaphoreHandle_t _filled;
+	SemaphoreHandle_t _free;
+	SemaphoreHandle_t _idle;
+	TaskHandle_t _task;
+	std::atomic<uint32_t> _floor_us;      // raised by the consumer, on underruns
+
+	// receiver task: arrivals
+	double _rate;                         // bytes/second
+	int64_t _window_start;
+	size_t _window_bytes;
+	int64_t _base_time;                   // the steady stream reference, reset with the rate
+	uint64_t _base_bytes;
+	uint64_t _total_bytes;
+	double _transit;                      // us
+	bool _has_transit;
+	double _jitter;                       // us
+
+	// consumer: drift steering
+	int64_t _steer_us;
+	double _fill;                         // bytes, smoothed; < 0 until the first steering
+	double _integral;                     // ppm
+	int32_t _ppm;
+
+	void _connect(const char *host, uint16_t port)
+	{
+		char service[8];
+		snprintf(service, sizeof(service), "%u", (unsigned)port);
+		addrinfo hints{};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *address = nullptr;
+		if ((::getaddrinfo(host, service, &hints, &address) != 0) || (address == nullptr))
+			throw basics::error{"net_stream: failed resolving '%s'", host};
+
+		_socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		auto connected = (_socket >= 0) && (::connect(_socket, address->ai_addr, address->ai_addrlen) == 0);
+		::freeaddrinfo(address);
+		if (!connected)
+			throw basics::error{"net_stream: failed connecting to %s:%u", host, (unsigned)port};
+
+		timeval timeout{_receive_timeout_s, 0};
+		::setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+
+	void _release()
+	{
+		if (_socket >= 0)
+			::close(_socket);
+		_socket = -1;
+
+		if (_free != nullptr)
+			vSemaphoreDelete(_free);
+		if (_filled != nullptr)
+			vSemaphoreDelete(_filled);
+		if (_idle != nullptr)
+			vSemaphoreDelete(_idle);
+		for (auto &block : _blocks) {
+			if (block != nullptr)
+				heap_caps_free(block);
+			block = nullptr;
+		}
+	}
+
+	// releases the block held, if any, and gets the next one, priming the buffer first as needed;
+	// false at the end of the stream
+	bool _next_block()
+	{
+		if (_holding) {
+			_stats.fill.fetch_sub(_sizes[_read_index], std::memory_order_relaxed);
+			_read_index = (_read_index + 1) % BLOCK_COUNT;
+			xSemaphoreGive(_free);
+			_holding = false;
+		}
+
+		if (!_primed || (uxSemaphoreGetCount(_filled) == 0)) {
+			if (_primed) {
+				_stats.underrun_count.fetch_add(1, std::memory_order_relaxed);
+				_floor_us.store(std::min(_floor_us.load(std::memory_order_relaxed) * 3 / 2, _floor_max_us),
+								std::memory_order_relaxed);
+			}
+			_prime();
+			_primed = true;
+		}
+		xSemaphoreTake(_filled, portMAX_DELAY);
+		_holding = true;
+
+		auto *block = _blocks[_read_index];
+		auto size = _sizes[_read_index];
+		setg(block, block, block + size);
+		_eof = (size == 0);
+
+		return !_eof;
+	}
+
+	// waits for the target fill, or the end of the stream
+	void _prime()
+	{
+		while (!_done.load(std::memory_order_acquire) && (uxSemaphoreGetCount(_filled) < BLOCK_COUNT)
+				&& (uxSemaphoreGetCount(_filled) * BLOCK_SIZE < _stats.target.load(std::memory_order_relaxed)))
+			vTaskDelay(_prime_poll_ms / portTICK_PERIOD_MS);
+	}
+
+	void _record_arrival(size_t size)
+	{
+		auto now = esp_timer_get_time();
+		_stats.byte_count.fetch_add(size, std::memory_order_relaxed);
+		if (_window_start == 0)
+			_window_start = now;
+		_window_bytes += size;
+		_total_bytes += size;
+
+		// a new rate moves the steady stream reference, the transit is measured anew from there
+		if (now - _window_start >= _rate_window_us) {
+			auto rate = _window_bytes * 1e6 / (now - _window_start);
+			_rate = (_rate == 0)? rate : _rate + (rate - _rate) / 4;
+			_window_start = now;
+			_window_bytes = 0;
+			_base_time = now;
+			_base_bytes = _total_bytes;
+			_has_transit = false;
+			_stats.byte_rate.store((uint32_t)_rate, std::memory_order_relaxed);
+
+			return;
+		}
+		if (_rate == 0)
+			return;
+
+		auto transit = (now - _base_time) - (_total_bytes - _base_bytes) * 1e6 / _rate;
+		if (_has_transit)
+			_jitter += (std::abs(transit - _transit) - _jitter) / 16;
+		_transit = transit;
+		_has_transit = true;
+		_stats.jitter_us.store((uint32_t)_jitter, std::memory_order_relaxed);
+
+		auto target_us = std::max(_jitter_factor * _jitter, (double)_floor_us.load(std::memory_order_relaxed));
+		auto target = std::clamp<double>(target_us * _rate / 1e6, 2 * BLOCK_SIZE, target_max);
+		_stats.target.store((uint32_t)target, std::memory_order_relaxed);
+	}
+
+	// hands the block over to the consumer; false on close
+	bool _hand_over(size_t size)
+	{
+		_sizes[_write_index] = size;
+		_stats.fill.fetch_add(size, std::memory_order_relaxed);
+		_write_index = (_write_index + 1) % BLOCK_COUNT;
+		xSemaphoreGive(_filled);
+
+		return !_quit;
+	}
+
+	void _receive_stream()
+	{
+		for (;;) {
+			xSemaphoreTake(_free, portMAX_DELAY);
+			if (_quit)
+				return;
+
+			auto *block = _blocks[_write_index];
+			auto size = size_t{0};
+			auto end = false;
+			while (!end && (size < BLOCK_SIZE)) {
+				auto count = ::recv(_socket, block + size, BLOCK_SIZE - size, 0);
+				if (count > 0) {
+					size += count;
+					_record_arrival(count);
+
+					continue;
+				}
+
+				if ((count < 0) && !_quit)
+					_stats.error_count.fetch_add(1, std::memory_order_relaxed);  // or timed out
+				end = true;
+			}
+			if (!_hand_over(size))
+				return;
+
+			if (end) {
+				// the empty block marks the end of the stream
+				if (size != 0) {
+					xSemaphoreTake(_free, portMAX_DELAY);
+					if (_quit || !_hand_over(0))
+						return;
+				}
+				_done.store(true, std::memory_order_release);
+
+				return;
+			}
+		}
+	}
+
+	static void _receive(void *arg)
+	{
+		auto *self = (net_stream_buffer<BLOCK_SIZE, BLOCK_COUNT> *)arg;
+
+		self->_receive_stream();
+
+		// the task lingers until the object goes
+		while (!self->_quit)
+			xSemaphoreTake(self->_free, portMAX_DELAY);
+		xSemaphoreGive(self->_idle);
+		vTaskDelete(nullptr);
+	}
+};
+
+
+#endif // NET_STREAM
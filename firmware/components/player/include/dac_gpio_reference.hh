@@ -0,0 +1,86 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_DAC_GPIO_REFERENCE
+#define PCM56_PLAYER_DAC_GPIO_REFERENCE
+
+#include "soc/gpio_reg.h"
+#include "player.hh"
+
+/**
+* @name dac gpio reference
+*
+* @brief The bit-by-bit PCM56 encoder dac_gpio had before its lookup tables, kept as the reference
+*        dac_gpio is checked against (tools/dac_gpio_check) and timed against (benchmark_isr in
+*        main). It only writes the registers: the pins are set up by a dac_gpio.
+*/
+
+
+class reference_dac_gpio {
+public:
+	explicit reference_dac_gpio(const stereo_player_config &config)
+		: _clk_bitmask{(uint32_t)1 << config.clk_gpio},
+		  _ch1_data_bitmask{(uint32_t)1 << config.ch1_data_gpio},
+		  _ch2_data_bitmask{(uint32_t)1 << config.ch2_data_gpio},
+		  _le_bitmask{(uint32_t)1 << config.le_gpio},
+		  _set_bitmask{0}, _reset_bitmask{0}
+	{}
+	reference_dac_gpio(const reference_dac_gpio&) = delete;
+	reference_dac_gpio(reference_dac_gpio&& other) = delete;
+
+	reference_dac_gpio& operator=(const reference_dac_gpio&) = delete;
+	reference_dac_gpio& operator=(reference_dac_gpio&& other) = delete;
+
+	inline void IRAM_ATTR set_samples_and_enable(int16_t &ch1_val, int16_t &ch2_val)
+	{
+		for (int i{15}, mask{1 << i}; i >= 0; --i, mask >>= 1) {
+			_set_bitmask = 0;
+			_reset_bitmask = 0;
+
+			if (i == 14)
+				_set_bitmask |= _le_bitmask;             // LE set
+
+			if (ch1_val & mask)
+				_set_bitmask |= _ch1_data_bitmask;
+			else
+				_reset_bitmask |= _ch1_data_bitmask;
+
+			if (ch2_val & mask)
+				_set_bitmask |= _ch2_data_bitmask;
+			else
+				_reset_bitmask |= _ch2_data_bitmask;
+
+			REG_WRITE(GPIO_OUT_W1TC_REG, _reset_bitmask);
+			REG_WRITE(GPIO_OUT_W1TS_REG, _set_bitmask);
+
+			REG_WRITE(GPIO_OUT_W1TS_REG, _clk_bitmask);  // CLK set
+			REG_WRITE(GPIO_OUT_W1TC_REG, _clk_bitmask);  // CLK reset
+		}
+
+		REG_WRITE(GPIO_OUT_W1TC_REG, _le_bitmask);       // LE reset
+	};
+
+private:
+	uint32_t _clk_bitmask;
+	uint32_t _ch1_data_bitmask;
+	uint32_t _ch2_data_bitmask;
+	uint32_t _le_bitmask;
+	uint32_t _set_bitmask;
+	uint32_t _reset_bitmask;
+};
+
+
+#endif // PCM56_PLAYER_DAC_GPIO_REFERENCE
@@ -0,0 +1,272 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_DMA_PLAYER
+#define PCM56_PLAYER_DMA_PLAYER
+
+#include <stdexcept>
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_lcd_panel_io.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "player.hh"
+
+/**
+* @name dma player
+*
+* @brief PCM56 output through the I2S peripheral in LCD (i80 parallel) mode, fed by DMA.
+*
+* The CLK, DATA1, DATA2 and LE lines become bits of a parallel bus word and every sample is
+* expanded into a fixed size frame of bus words, the exact pin sequence the bit-banged dac_gpio
+* produces. The peripheral then clocks the frames out at sample_rate * frame_size words per second,
+* so the per-sample CPU cost is reduced to encoding the frame, done in task context.
+*/
+
+
+/**
+* @brief Pin to bus line mapping of the parallel PCM56 bitstream.
+*/
+struct pcm56_bitstream {
+	using word_type = uint8_t;
+
+	// bus data lines
+	static constexpr const word_type clk = 1 << 0;
+	static constexpr const word_type data1 = 1 << 1;
+	static constexpr const word_type data2 = 1 << 2;
+	static constexpr const word_type le = 1 << 3;
+
+	// 16 bits x (data, data + CLK set, data + CLK reset), LE reset, padding to an even size
+	static constexpr const size_t frame_size = 50;
+
+	/**
+	* @brief Writes the frame of the encoded sample into out[0..frame_size).
+	*
+	* Produces the same sequence of pin states as dac_gpio::set_sample_and_enable: for each bit,
+	* MSB first, the data lines are set, CLK is raised and reset; LE goes high along with bit 14
+	* and is reset after the last clock. The transient state between the W1TC and W1TS writes of
+	* the bit-banged output carries no CLK edge and has no counterpart here.
+	*/
+	static inline void encode(encoded_sample_type value, word_type *out)
+	{
+		auto word = word_type{0};
+		auto pos = size_t{0};
+		for (int i{0}; i < 16; ++i) {
+			word = _data_words[pcm56_encoding::code(value, i)] | ((i > 0)? le : 0);
+			out[_index(pos++)] = word;
+			out[_index(pos++)] = word | clk;
+			out[_index(pos++)] = word;
+		}
+
+		word &= ~le;
+		while (pos < frame_size)
+			out[_index(pos++)] = word;
+	}
+
+private:
+	// data lines of each 2 bit code
+	static constexpr const word_type _data_words[4] = {0, data2, data1, data1 | data2};
+
+	// the ESP32 I2S in 8 bit LCD mode shifts out the two bytes of each 16 bit half-word swapped
+	static constexpr inline size_t _index(size_t pos)
+	{
+#if CONFIG_IDF_TARGET_ESP32
+		return pos ^ 1;
+#else
+		return pos;
+#endif
+	}
+};
+
+
+struct dma_player_config {
+	stereo_player_config &pins;
+	// the LCD peripheral needs a full 8 bit bus plus a write strobe and a D/C line: these go to
+	// otherwise unused GPIOs
+	int8_t spare_data_gpios[4];
+	int8_t wr_gpio;
+	int8_t dc_gpio;
+	uint8_t core;
+};
+
+
+/**
+* @brief Stereo player streaming the BUFFER to the PCM56 chips through DMA.
+*
+* A feeder task moves the buffered samples, chunk by chunk, into a small pool of DMA capable frame
+* buffers and queues them to the i80 bus. Buffer underruns are concealed by fading the last sample
+* out, as in stereo_player, so that the bus keeps running at a constant word rate.
+*/
+template<typename BUFFER>
+class stereo_dma_player {
+public:
+	using config_type = dma_player_config;
+	using bitstream_type = pcm56_bitstream;
+	using word_type = bitstream_type::word_type;
+
+	static constexpr const size_t chunk_size = 128;        // samples per DMA transaction
+	static constexpr const size_t chunk_count = 3;         // DMA transactions in flight
+
+	stereo_dma_player(const config_type &config, BUFFER &stream_buffer, player_stats &stats,
+							size_t sample_rate = player_sample_rate, double frequency_calibration = 1)
+		: _config{config}, _buffer{stream_buffer}, _stats{stats}, _bus{nullptr}, _io{nullptr},
+		  _chunks{}, _next_chunk{0}, _free_chunks{nullptr}, _stopped{nullptr}, _task{nullptr}, _running{true},
+		  _concealment{}
+	{
+		for (auto &chunk : _chunks) {
+			chunk = (word_type *)heap_caps_aligned_alloc(4, _chunk_bytes, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+			if (chunk == nullptr)
+				throw std::runtime_error("stereo_dma_player: DMA buffer allocation failure");
+		}
+
+		// one extra count for the wake up token given on destruction
+		_free_chunks = xSemaphoreCreateCounting(chunk_count + 1, chunk_count);
+		_stopped = xSemaphoreCreateBinary();
+		if ((_free_chunks == nullptr) || (_stopped == nullptr))
+			throw std::runtime_error("stereo_dma_player: semaphore allocation failure");
+
+		esp_lcd_i80_bus_config_t bus_config = {};
+		bus_config.dc_gpio_num = _config.dc_gpio;
+		bus_config.wr_gpio_num = _config.wr_gpio;
+		bus_config.clk_src = LCD_CLK_SRC_DEFAULT;
+		bus_config.data_gpio_nums[0] = _config.pins.clk_gpio;
+		bus_config.data_gpio_nums[1] = _config.pins.ch1_data_gpio;
+		bus_config.data_gpio_nums[2] = _config.pins.ch2_data_gpio;
+		bus_config.data_gpio_nums[3] = _config.pins.le_gpio;
+		for (size_t i = 0; i < 4; ++i)
+			bus_config.data_gpio_nums[4 + i] = _config.spare_data_gpios[i];
+		bus_config.bus_width = 8;
+		bus_config.max_transfer_bytes = _chunk_bytes;
+		bus_config.sram_trans_align = 4;
+		ESP_ERROR_CHECK(esp_lcd_new_i80_bus(&bus_config, &_bus));
+
+		// the word clock is rounded to the LCD clock divider, as the gptimer alarm count is
+		esp_lcd_panel_io_i80_config_t io_config = {};
+		io_config.cs_gpio_num = -1;
+		io_config.pclk_hz = (uint32_t)(sample_rate * player_oversampling * bitstream_type::frame_size / frequency_calibration);
+		io_config.trans_queue_depth = chunk_count;
+		io_config.on_color_trans_done = &stereo_dma_player<BUFFER>::_on_chunk_done;
+		io_config.user_ctx = this;
+		io_config.lcd_cmd_bits = 8;
+		io_config.lcd_param_bits = 8;
+		io_config.dc_levels.dc_data_level = 1;
+		ESP_ERROR_CHECK(esp_lcd_new_panel_io_i80(_bus, &io_config, &_io));
+
+		if (xTaskCreatePinnedToCore(&stereo_dma_player<BUFFER>::_feed, "dma_player", 3072, this,
+										configMAX_PRIORITIES - 2, &_task, _config.core) != pdPASS)
+			throw std::runtime_error("stereo_dma_player: task creation failure");
+		printf("%s: Started DMA output @ %zu samples/second\n", _tag, sample_rate);
+	}
+	stereo_dma_player(const stereo_dma_player&) = delete;
+	stereo_dma_player(stereo_dma_player&& other) = delete;
+
+	stereo_dma_player& operator=(const stereo_dma_player&) = delete;
+	stereo_dma_player& operator=(stereo_dma_player&& other) = delete;
+
+	~stereo_dma_player()
+	{
+		// wake the feeder up in case it waits for a chunk, let it exit, then wait for the DMA
+		_running = false;
+		xSemaphoreGive(_free_chunks);
+		xSemaphoreTake(_stopped, portMAX_DELAY);
+		for (size_t i = 0; i < chunk_count + 1; ++i)
+			xSemaphoreTake(_free_chunks, portMAX_DELAY);
+
+		ESP_ERROR_CHECK(esp_lcd_panel_io_del(_io));
+		ESP_ERROR_CHECK(esp_lcd_del_i80_bus(_bus));
+
+		vSemaphoreDelete(_stopped);
+		vSemaphoreDelete(_free_chunks);
+		for (auto &chunk : _chunks)
+			heap_caps_free(chunk);
+	}
+
+	/**
+	* @brief The i80 bus clock is fixed while the bus is up: a new calibration applies from the
+	*        next player on.
+	*/
+	void set_frequency_calibration(double /*frequency_calibration*/)
+	{}
+
+private:
+	static const constexpr char *_tag = "stereo_dma_player";
+	static constexpr const size_t _chunk_bytes = chunk_size * bitstream_type::frame_size * sizeof(word_type);
+
+	const config_type &_config;
+	BUFFER &_buffer;
+	player_stats &_stats;
+	esp_lcd_i80_bus_handle_t _bus;
+	esp_lcd_panel_io_handle_t _io;
+	word_type *_chunks[chunk_count];
+	size_t _next_chunk;
+	SemaphoreHandle_t _free_chunks;
+	SemaphoreHandle_t _stopped;
+	TaskHandle_t _task;
+	volatile bool _running;
+	underrun_concealment _concealment;
+
+	static bool IRAM_ATTR _on_chunk_done(esp_lcd_panel_io_handle_t /*io*/, esp_lcd_panel_io_event_data_t */*edata*/, void *user_ctx)
+	{
+		auto *self = (stereo_dma_player<BUFFER> *)user_ctx;
+		BaseType_t task_woken = pdFALSE;
+
+		xSemaphoreGiveFromISR(self->_free_chunks, &task_woken);
+
+		return (task_woken == pdTRUE);
+	}
+
+	static void _feed(void *arg)
+	{
+		auto *self = (stereo_dma_player<BUFFER> *)arg;
+
+		while (self->_running) {
+			xSemaphoreTake(self->_free_chunks, portMAX_DELAY);
+			if (!self->_running) {
+				xSemaphoreGive(self->_free_chunks);
+				break;
+			}
+
+			auto *chunk = self->_chunks[self->_next_chunk];
+			self->_next_chunk = (self->_next_chunk + 1) % chunk_count;
+
+			self->_fill(chunk);
+			self->_buffer.template notify_space<task_operation>();
+			ESP_ERROR_CHECK(esp_lcd_panel_io_tx_color(self->_io, -1, chunk, _chunk_bytes));
+		}
+
+		xSemaphoreGive(self->_stopped);
+		vTaskDelete(nullptr);
+	}
+
+	// profiled per sample, as averaged over the chunk
+	void _fill(word_type *chunk)
+	{
+		auto start = esp_cpu_get_cycle_count();
+
+		for (size_t i = 0; i < chunk_size; ++i, chunk += bitstream_type::frame_size) {
+			auto value = _concealment.next(_buffer.template get<task_operation>(), _stats);
+			bitstream_type::encode(value, chunk);
+		}
+		_stats.sample_played(chunk_size);
+
+		if constexpr (player_profiling)
+			_stats.profile.record((esp_cpu_get_cycle_count() - start) / chunk_size);
+	}
+};
+
+
+#endif // PCM56_PLAYER_DMA_PLAYER
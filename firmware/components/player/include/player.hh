@@ -17,7 +17,12 @@
 #ifndef PCM56_PLAYER_PLAYER
 #define PCM56_PLAYER_PLAYER
 
+#include <cmath>
+#include <atomic>
+#include <optional>
 #include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
 #include "soc/gpio_reg.h"
 #include "driver/gpio.h"
 #include "driver/gptimer.h"
@@ -39,16 +44,80 @@ struct stereo_player_config {
 };
 
 
+struct stereo_sample_type {
+	int16_t channel_0;
+	int16_t channel_1;
+};
+
+
+/**
+* @brief PCM56 sample encoding, done on the task side ahead of the ISR.
+*
+* The bits of both channels are interleaved MSB first into one word, two bits per DAC clock
+* cycle, channel 0 in the upper bit. The ISR then shifts out 2 bit codes and looks up the
+* matching GPIO set/reset words, with no per-bit decisions. Encoding is branchless (bit spreading).
+*/
+using encoded_sample_type = uint32_t;
+
+struct pcm56_encoding {
+	static inline encoded_sample_type encode(int16_t ch1_val, int16_t ch2_val)
+	{
+		return (_spread((uint16_t)ch1_val) << 1) | _spread((uint16_t)ch2_val);
+	}
+
+	static inline encoded_sample_type encode(const stereo_sample_type &value)
+	{
+		return encode(value.channel_0, value.channel_1);
+	}
+
+	static inline stereo_sample_type IRAM_ATTR decode(encoded_sample_type value)
+	{
+		return {(int16_t)_compact(value >> 1), (int16_t)_compact(value)};
+	}
+
+	// 2 bit code of the index-th DAC clock cycle, MSB first
+	static inline uint8_t IRAM_ATTR code(encoded_sample_type value, int index)
+	{
+		return (value >> (30 - 2 * index)) & 0x3;
+	}
+
+private:
+	static inline uint32_t IRAM_ATTR _spread(uint32_t x)
+	{
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		return (x | (x << 1)) & 0x55555555;
+	}
+
+	static inline uint32_t IRAM_ATTR _compact(uint32_t x)
+	{
+		x &= 0x55555555;
+		x = (x | (x >> 1)) & 0x33333333;
+		x = (x | (x >> 2)) & 0x0f0f0f0f;
+		x = (x | (x >> 4)) & 0x00ff00ff;
+		return (x | (x >> 8)) & 0x0000ffff;
+	}
+};
+
+
 class dac_gpio {
 public:
 	explicit dac_gpio(const stereo_player_config &config)
 		: _config{config},
-		  _clk_bitmask{1ul << _config.clk_gpio},
-		  _ch1_data_bitmask{1ul << _config.ch1_data_gpio},
-		  _ch2_data_bitmask{1ul << _config.ch2_data_gpio},
-		  _le_bitmask{1ul << _config.le_gpio},
-		  _set_bitmask{0}, _reset_bitmask{0}
+		  _clk_bitmask{(uint32_t)1 << _config.clk_gpio},
+		  _ch1_data_bitmask{(uint32_t)1 << _config.ch1_data_gpio},
+		  _ch2_data_bitmask{(uint32_t)1 << _config.ch2_data_gpio},
+		  _le_bitmask{(uint32_t)1 << _config.le_gpio},
+		  _set_bitmask{}, _set_le_bitmask{}, _reset_bitmask{}
 	{
+		// set/reset words of each 2 bit code
+		for (uint8_t code = 0; code < 4; ++code) {
+			_set_bitmask[code] = ((code & 0x2)? _ch1_data_bitmask : 0) | ((code & 0x1)? _ch2_data_bitmask : 0);
+			_set_le_bitmask[code] = _set_bitmask[code] | _le_bitmask;
+			_reset_bitmask[code] = (_ch1_data_bitmask | _ch2_data_bitmask) & ~_set_bitmask[code];
+		}
+
 		// PCM56 gpio setup
 		gpio_config_t pcm_gpio_conf = {};
 		pcm_gpio_conf.intr_type = GPIO_INTR_DISABLE;
@@ -74,27 +143,30 @@ public:
 		gpio_reset_pin((gpio_num_t)_config.le_gpio);
 	}
 
-	inline void set_samples_and_enable(int16_t &ch1_val, int16_t &ch2_val)
+	inline void IRAM_ATTR set_sample_and_enable(encoded_sample_type value)
 	{
-		for (int i{15}, mask{1 << i}; i >= 0; --i, mask >>= 1) {
-			_set_bitmask = 0;
-			_reset_bitmask = 0;
+		// MSB: LE still low
+		auto code = value >> 30;
+		REG_WRITE(GPIO_OUT_W1TC_REG, _reset_bitmask[code]);
+		REG_WRITE(GPIO_OUT_W1TS_REG, _set_bitmask[code]);
 
-			if (i == 14)
-				_set_bitmask |= _le_bitmask;             // LE set
+		REG_WRITE(GPIO_OUT_W1TS_REG, _clk_bitmask);      // CLK set
+		REG_WRITE(GPIO_OUT_W1TC_REG, _clk_bitmask);      // CLK reset
 
-			if (ch1_val & mask)
-				_set_bitmask |= _ch1_data_bitmask;
-			else
-				_reset_bitmask |= _ch1_data_bitmask;
+		// LE set along with the next bit
+		value <<= 2;
+		code = value >> 30;
+		REG_WRITE(GPIO_OUT_W1TC_REG, _reset_bitmask[code]);
+		REG_WRITE(GPIO_OUT_W1TS_REG, _set_le_bitmask[code]);
 
-			if (ch2_val & mask)
-				_set_bitmask |= _ch2_data_bitmask;
-			else
-				_reset_bitmask |= _ch2_data_bitmask;
+		REG_WRITE(GPIO_OUT_W1TS_REG, _clk_bitmask);      // CLK set
+		REG_WRITE(GPIO_OUT_W1TC_REG, _clk_bitmask);      // CLK reset
 
-			REG_WRITE(GPIO_OUT_W1TC_REG, _reset_bitmask);
-			REG_WRITE(GPIO_OUT_W1TS_REG, _set_bitmask);
+		for (int i{13}; i >= 0; --i) {
+			value <<= 2;
+			code = value >> 30;
+			REG_WRITE(GPIO_OUT_W1TC_REG, _reset_bitmask[code]);
+			REG_WRITE(GPIO_OUT_W1TS_REG, _set_bitmask[code]);
 
 			REG_WRITE(GPIO_OUT_W1TS_REG, _clk_bitmask);  // CLK set
 			REG_WRITE(GPIO_OUT_W1TC_REG, _clk_bitmask);  // CLK reset
@@ -109,16 +181,12 @@ private:
 	uint32_t _ch1_data_bitmask;
 	uint32_t _ch2_data_bitmask;
 	uint32_t _le_bitmask;
-	uint32_t _set_bitmask;
-	uint32_t _reset_bitmask;
+	uint32_t _set_bitmask[4];
+	uint32_t _set_le_bitmask[4];
+	uint32_t _reset_bitmask[4];
 };
 
 
-struct stereo_sample_type {
-	int16_t channel_0;
-	int16_t channel_1;
-};
-
 using player_sample_type = int16_t;
 
 static constexpr const uint8_t player_channel_count = 2;
@@ -126,21 +194,177 @@ static constexpr const uint8_t player_sample_bit_size = 16;
 static constexpr const size_t player_sample_rate = 44100;
 static constexpr const size_t player_oversampling = 1;  // esp32 cannot handle more in || w/ other tasks
 static constexpr const uint64_t _timer_resolution_hz = 40000000; // 40MHz
+static constexpr const bool player_profiling = false;  // ISR cycle counting, see isr_profile; adds to the ISR time
 
-template<typename BUFFER>
-class stereo_player {
+
+/**
+* @brief Cycle counts of the per-sample output path, written by the ISR only.
+*
+* Cycles are counted from the entry to the exit of the ISR callback, so the interrupt dispatch
+* overhead is not included. The mean is published every 2^16 samples, the histogram has a bucket
+* per power of two (bucket i counts durations in [2^i, 2^(i+1)) cycles).
+*/
+struct isr_profile {
+	static constexpr const size_t bucket_count = 16;
+
+	std::atomic<uint32_t> count{0};
+	std::atomic<uint32_t> min{UINT32_MAX};
+	std::atomic<uint32_t> max{0};
+	std::atomic<uint32_t> mean{0};
+	std::atomic<uint32_t> histogram[bucket_count]{};
+
+	void reset()
+	{
+		count.store(0, std::memory_order_relaxed);
+		min.store(UINT32_MAX, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+		mean.store(0, std::memory_order_relaxed);
+		for (auto &bucket : histogram)
+			bucket.store(0, std::memory_order_relaxed);
+		_reset = true;
+	}
+
+	inline void IRAM_ATTR record(uint32_t cycles)
+	{
+		if (_reset) {
+			_window_count = 0;
+			_window_total = 0;
+			_reset = false;
+		}
+
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (cycles < min.load(std::memory_order_relaxed))
+			min.store(cycles, std::memory_order_relaxed);
+		if (cycles > max.load(std::memory_order_relaxed))
+			max.store(cycles, std::memory_order_relaxed);
+
+		auto bucket = (cycles == 0)? 0 : std::min<size_t>(31 - __builtin_clz(cycles), bucket_count - 1);
+		histogram[bucket].store(histogram[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		_window_total += cycles;
+		if (++_window_count == _window_size) {
+			mean.store(_window_total / _window_size, std::memory_order_relaxed);
+			_window_count = 0;
+			_window_total = 0;
+		}
+	}
+
+private:
+	static constexpr const uint32_t _window_size = 1 << 16;
+
+	uint32_t _window_count{0};
+	uint32_t _window_total{0};
+	volatile bool _reset{false};
+};
+
+
+/**
+* @brief Buffer underrun counters, written by the ISR only and readable from any task.
+*
+* A gap is a run of consecutive sample periods in which the buffer had no data. It is accounted
+* for once playback resumes, so the drain at the end of a track is not reported as an underrun.
+*/
+struct player_stats {
+	std::atomic<uint32_t> underrun_count{0};
+	std::atomic<uint32_t> concealed_count{0};  // samples faded out instead of played
+	std::atomic<uint32_t> worst_gap{0};        // in samples
+	std::atomic<uint32_t> played_count{0};     // sample periods output, wraps around; see sample_played
+	std::atomic<uint32_t> consumed_count{0};   // buffered samples played, wraps around; underruns left out
+	std::atomic<uint32_t> start_count{0};      // players that output their first sample
+	std::atomic<uint32_t> start_us{0};         // when the last one did, low 32 bits of esp_timer_get_time
+	isr_profile profile{};
+
+	void reset()
+	{
+		underrun_count.store(0, std::memory_order_relaxed);
+		concealed_count.store(0, std::memory_order_relaxed);
+		worst_gap.store(0, std::memory_order_relaxed);
+	}
+
+	inline void IRAM_ATTR sample_played(uint32_t count = 1)
+	{
+		played_count.store(played_count.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	}
+
+	inline void IRAM_ATTR sample_consumed()
+	{
+		consumed_count.store(consumed_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	inline void IRAM_ATTR started()
+	{
+		start_us.store((uint32_t)esp_timer_get_time(), std::memory_order_relaxed);
+		start_count.store(start_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	inline void IRAM_ATTR record_gap(uint32_t gap)
+	{
+		underrun_count.store(underrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		concealed_count.store(concealed_count.load(std::memory_order_relaxed) + gap, std::memory_order_relaxed);
+		if (gap > worst_gap.load(std::memory_order_relaxed))
+			worst_gap.store(gap, std::memory_order_relaxed);
+	}
+};
+
+
+/**
+* @brief Buffer underrun concealment: holds the last sample sent to the DAC and fades it out, by
+*        ~15/16 per sample, while the buffer has no data (zero within ~150 samples, ~3.5ms).
+*/
+class underrun_concealment {
 public:
-	using config_type = stereo_player_config;
-	using dac_gpio_type = dac_gpio;
+	inline encoded_sample_type IRAM_ATTR next(const std::optional<encoded_sample_type> &value, player_stats &stats)
+	{
+		if (value) {
+			if (_gap) {
+				stats.record_gap(_gap);
+				_gap = 0;
+			}
+			if (!_primed)
+				stats.started();
+			stats.sample_consumed();
+			_primed = true;
+			_sample = *value;
+		} else {
+			if (_primed)
+				++_gap;
+			if (_sample) {
+				auto sample = pcm56_encoding::decode(_sample);
+				_sample = pcm56_encoding::encode(_fade_out(sample.channel_0), _fade_out(sample.channel_1));
+			}
+		}
 
-	stereo_player(const config_type &config, BUFFER &stream_buffer,
-							size_t sample_rate = player_sample_rate, double frequency_calibration = 1)
-		: _config{config},
-		  _gpio{_config},
-		  _context{.buffer{stream_buffer}, .gpio{_gpio}, .play_cnt{player_oversampling}, .stereo_sample{}},
-		  _gptimer{nullptr}
+		return _sample;
+	}
+
+private:
+	encoded_sample_type _sample{0};       // last sample sent to the DAC
+	uint32_t _gap{0};                     // current underrun length, in samples
+	bool _primed{false};                  // first sample played, underruns count from here on
+
+	static inline int16_t IRAM_ATTR _fade_out(int16_t value)
+	{
+		return (int16_t)((value * 15) / 16);
+	}
+};
+
+
+/**
+* @brief Sample clock: a gptimer alarm scheduled as a phase accumulator.
+*
+* The sample period, in timer ticks, is kept in Q32 fixed point and the alarm is moved forward by
+* it on each tick, the fraction carried into the next period. The period is thus exact to ~10^-12
+* on average (the integer 40MHz tick count alone is off by up to ~1100ppm at 44.1kHz), with one
+* tick of jitter. The alarm is set from the ISR, which needs CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM.
+*/
+template<typename HANDLER>
+class gptimer_clock {
+public:
+	gptimer_clock(void *context, size_t sample_rate, double frequency_calibration = 1)
+		: _gptimer{nullptr}, _context{context}, _sample_rate{sample_rate},
+		  _period{_period_of(sample_rate, frequency_calibration)}, _next_period{0}, _period_update{false},
+		  _alarm{0}, _alarm_frac{0}
 	{
-// 		printf("%s: Starting timer @ %zu samples/second\n", _tag, sample_rate);
 		gptimer_config_t timer_config = {
 			.clk_src = GPTIMER_CLK_SRC_DEFAULT,
 			.direction = GPTIMER_COUNT_UP,
@@ -149,35 +373,33 @@ public:
 			.flags{}
 		};
 		ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &_gptimer));
-// 		printf("%s: Timer created\n", _tag);
 
 		gptimer_event_callbacks_t cbs = {
-			.on_alarm = &stereo_player<BUFFER>::play_data,
+			.on_alarm = &gptimer_clock<HANDLER>::_on_alarm,
 		};
-		ESP_ERROR_CHECK(gptimer_register_event_callbacks(_gptimer, &cbs, &_context));
+		ESP_ERROR_CHECK(gptimer_register_event_callbacks(_gptimer, &cbs, this));
 
-// 		printf("%s: Enable timer\n", _tag);
 		ESP_ERROR_CHECK(gptimer_enable(_gptimer));
 
-// 		printf("%s: Start timer\n", _tag);
+		_advance();
 		gptimer_alarm_config_t alarm_config = {
-			.alarm_count = (uint64_t)(_timer_resolution_hz * frequency_calibration / (sample_rate * player_oversampling)),
+			.alarm_count = _alarm,
 			.reload_count = 0,
 			.flags {
-				.auto_reload_on_alarm = true
+				.auto_reload_on_alarm = false
 			}
 		};
 		ESP_ERROR_CHECK(gptimer_set_alarm_action(_gptimer, &alarm_config));
 		ESP_ERROR_CHECK(gptimer_start(_gptimer));
 		printf("%s: Started timer @ %zu samples/second\n", _tag, sample_rate);
 	}
-	stereo_player(const stereo_player&) = delete;
-	stereo_player(stereo_player&& other) = delete;
+	gptimer_clock(const gptimer_clock&) = delete;
+	gptimer_clock(gptimer_clock&& other) = delete;
 
-	stereo_player& operator=(const stereo_player&) = delete;
-	stereo_player& operator=(stereo_player&& other) = delete;
+	gptimer_clock& operator=(const gptimer_clock&) = delete;
+	gptimer_clock& operator=(gptimer_clock&& other) = delete;
 
-	~stereo_player()
+	~gptimer_clock()
 	{
 		ESP_ERROR_CHECK(gptimer_stop(_gptimer));
 
@@ -186,31 +408,138 @@ public:
 		ESP_ERROR_CHECK(gptimer_del_timer(_gptimer));
 	}
 
-	static bool IRAM_ATTR NOINLINE_ATTR play_data(gptimer_handle_t timer, const gptimer_alarm_event_data_t */*ev_data*/, void *user_ctx)
+	/**
+	* @brief Retunes the running clock; the ISR picks the new period up on its next tick.
+	*/
+	void set_frequency_calibration(double frequency_calibration)
+	{
+		while (_period_update.load(std::memory_order_acquire))
+			;  // a previous update is pending for less than a sample period
+
+		_next_period = _period_of(_sample_rate, frequency_calibration);
+		_period_update.store(true, std::memory_order_release);
+	}
+
+private:
+	static const constexpr char *_tag = "gptimer_clock";
+
+	gptimer_handle_t _gptimer;
+	void *_context;
+	size_t _sample_rate;
+	uint64_t _period;                   // Q32 timer ticks per sample
+	uint64_t _next_period;
+	std::atomic<bool> _period_update;
+	uint64_t _alarm;                    // timer ticks
+	uint32_t _alarm_frac;               // Q32 fraction of a tick
+
+	static uint64_t _period_of(size_t sample_rate, double frequency_calibration)
+	{
+		return (uint64_t)llround(_timer_resolution_hz * frequency_calibration / (sample_rate * player_oversampling) * 4294967296.0);
+	}
+
+	inline void IRAM_ATTR _advance()
 	{
+		auto frac = (uint64_t)_alarm_frac + (uint32_t)_period;
+		_alarm_frac = (uint32_t)frac;
+		_alarm += (_period >> 32) + (frac >> 32);
+	}
+
+	static bool IRAM_ATTR NOINLINE_ATTR _on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t */*ev_data*/, void *user_ctx)
+	{
+		auto *self = (gptimer_clock<HANDLER> *)user_ctx;
+		auto yield = HANDLER::play_data(self->_context);
+
+		if (self->_period_update.load(std::memory_order_acquire)) {
+			self->_period = self->_next_period;
+			self->_period_update.store(false, std::memory_order_release);
+		}
+		self->_advance();
+
+		gptimer_alarm_config_t alarm_config = {
+			.alarm_count = self->_alarm,
+			.reload_count = 0,
+			.flags {
+				.auto_reload_on_alarm = false
+			}
+		};
+		gptimer_set_alarm_action(timer, &alarm_config);
+
+		return yield;
+	}
+};
+
+
+/**
+* @brief Stereo player driving the OUTPUT (DAC) from the BUFFER at each CLOCK tick.
+*
+* The OUTPUT and the CLOCK are template parameters so that the pipeline can be driven by other
+* sample sources than the gptimer (e.g. a simulated clock) and can write into other sinks than the
+* GPIO registers (e.g. a recording mock). An OUTPUT type must be constructible from a
+* stereo_player_config and provide set_sample_and_enable(encoded_sample_type). A CLOCK<HANDLER> type
+* must be constructible from (void *context, size_t sample_rate, double frequency_calibration), call
+* HANDLER::play_data(context) once per sample period, yielding when it returns true (a task waiting
+* for buffer space was woken), and provide set_frequency_calibration(double).
+* The frequency calibration scales the sample period.
+*/
+template<typename BUFFER, typename OUTPUT = dac_gpio, template<typename> class CLOCK = gptimer_clock>
+class stereo_player {
+public:
+	using config_type = stereo_player_config;
+	using dac_gpio_type = OUTPUT;
+	using clock_type = CLOCK<stereo_player<BUFFER, OUTPUT, CLOCK>>;
+
+	stereo_player(const config_type &config, BUFFER &stream_buffer, player_stats &stats,
+							size_t sample_rate = player_sample_rate, double frequency_calibration = 1)
+		: _config{config},
+		  _gpio{_config},
+		  _context{.buffer{stream_buffer}, .gpio{_gpio}, .stats{stats}, .play_cnt{player_oversampling},
+		  			.concealment{}},
+		  _clock{&_context, sample_rate, frequency_calibration}
+	{}
+	stereo_player(const stereo_player&) = delete;
+	stereo_player(stereo_player&& other) = delete;
+
+	stereo_player& operator=(const stereo_player&) = delete;
+	stereo_player& operator=(stereo_player&& other) = delete;
+
+	~stereo_player() = default;
+
+	void set_frequency_calibration(double frequency_calibration)
+	{
+		_clock.set_frequency_calibration(frequency_calibration);
+	}
+
+	static inline bool IRAM_ATTR play_data(void *user_ctx)
+	{
+		auto start = esp_cpu_get_cycle_count();
 		_context_type *context = (_context_type *)user_ctx;
 
-		auto value = context->buffer.template get<isr_operation>();
-		if (value)
-			context->gpio.set_samples_and_enable(value->channel_0, value->channel_1);
+		// on underrun, fade the last sample out instead of replaying stale data
+		context->gpio.set_sample_and_enable(
+			context->concealment.next(context->buffer.template get<isr_operation>(), context->stats));
 
-		return true;
+		context->stats.sample_played();
+		auto task_woken = context->buffer.template notify_space<isr_operation>();
+
+		if constexpr (player_profiling)
+			context->stats.profile.record(esp_cpu_get_cycle_count() - start);
+
+		return task_woken;
 	}
 
 private:
-	static const constexpr char *_tag = "stereo_player";
-
 	struct _context_type {
 		BUFFER &buffer;
 		dac_gpio_type &gpio;
+		player_stats &stats;
 		size_t play_cnt;
-		stereo_sample_type stereo_sample;
+		underrun_concealment concealment;
 	};
 
 	const config_type &_config;
 	dac_gpio_type _gpio;
 	_context_type _context;
-	gptimer_handle_t _gptimer;
+	clock_type _clock;
 };
 
 
@@ -0,0 +1,274 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_RESAMPLER
+#define PCM56_PLAYER_RESAMPLER
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "player.hh"
+
+/**
+* @name resampler
+*
+* @brief Fixed-point polyphase sample rate converter, between the decoder and the player buffer.
+*/
+
+
+// highest source sample rate the resampler is meant for (decimation by up to ~2.2)
+static constexpr const size_t player_max_sample_rate = 96000;
+
+
+/**
+* @brief Converts planar SOURCE samples at any rate up to player_max_sample_rate to the output rate.
+*
+* The prototype is a Blackman windowed sinc, cut off below the lower of the two Nyquist frequencies
+* and split into PHASES Q15 sub-filters, each normalised to unity DC gain. It is TAPS long at the
+* source rate when interpolating, and longer by the ratio when decimating, rounded up to an even
+* count, so that its transition band keeps its width at the output rate. The output position
+* advances in Q32 source samples; its fractional part selects two adjacent phases, whose outputs
+* are interpolated linearly by the bits below the phase. Source samples are pulled lazily, so the
+* output count a source block yields is known up front (output_count) and the output can be
+* produced in pieces of any size, straight into the player buffer slots. Output samples are
+* clipped to the source bit size.
+*
+* The sub-filters are built for a pair of rates and kept until configure() is given another pair.
+* The source history and position carry on across configure() calls for the same stream format,
+* so that back to back tracks convert as one stream; reset() drops them, on a discontinuity.
+*
+* The convolution accumulates in 32 bits where the source bit size leaves room for the filter gain
+* (up to 16 bit sources), in 64 bits otherwise; the kernel is specialised for either, at compile
+* time, and kept in IRAM along with run().
+*/
+template<typename SOURCE, size_t TAPS = 24, size_t PHASES = 128, size_t CHUNK_SIZE = 256>
+class polyphase_resampler {
+public:
+	static_assert((PHASES & (PHASES - 1)) == 0, "polyphase_resampler: PHASES must be a power of two");
+	static_assert(TAPS % 2 == 0, "polyphase_resampler: TAPS must be even");
+
+	static constexpr const size_t tap_count = TAPS;
+	// decimating from player_max_sample_rate to player_sample_rate
+	static constexpr const size_t max_tap_count = (TAPS * player_max_sample_rate / player_sample_rate + 2) & ~(size_t)1;
+	static constexpr const size_t phase_count = PHASES;
+	static constexpr const size_t chunk_size = CHUNK_SIZE;
+
+	polyphase_resampler()
+		: _input_rate{0}, _output_rate{0}, _sample_bit_size{0}, _step{0}, _nominal_step{0}, _frac{0}, _need{0},
+		  _channel_count{0}, _min{0}, _max{0}, _gain_max{0}, _narrow{false}, _taps{TAPS}, _history_pos{0}, _coefs{},
+		  _history{}, _out{}
+	{}
+	polyphase_resampler(const polyphase_resampler&) = delete;
+	polyphase_resampler(polyphase_resampler&& other) = delete;
+
+	polyphase_resampler& operator=(const polyphase_resampler&) = delete;
+	polyphase_resampler& operator=(polyphase_resampler&& other) = delete;
+
+	void configure(size_t input_rate, size_t output_rate, uint8_t channel_count, uint8_t sample_bit_size)
+	{
+		if ((input_rate == 0) || (input_rate > player_max_sample_rate) || (channel_count == 0) || (channel_count > 2))
+			throw std::runtime_error("polyphase_resampler: unsupported stream");
+
+		auto rates_changed = (input_rate != _input_rate) || (output_rate != _output_rate);
+		if (!rates_changed && (channel_count == _channel_count) && (sample_bit_size == _sample_bit_size)) {
+			_step = _nominal_step;
+
+			return;  // the same stream format: the next track follows on from the history
+		}
+
+		_step = ((uint64_t)input_rate << 32) / output_rate;
+		_nominal_step = _step;
+		_channel_count = channel_count;
+		_sample_bit_size = sample_bit_size;
+		_max = (int32_t)((1ul << (sample_bit_size - 1)) - 1);
+		_min = -_max - 1;
+
+		if (rates_changed) {
+			auto taps = (size_t)std::ceil((double)TAPS * std::max(input_rate, output_rate) / output_rate);
+			_taps = std::min((taps + 1) & ~(size_t)1, max_tap_count);
+			_build(input_rate, output_rate);
+			_input_rate = input_rate;
+			_output_rate = output_rate;
+		}
+		reset();
+		_narrow = ((_max + 1ll) * _gain_max + (1 << 14) <= INT32_MAX);
+	}
+
+	/**
+	* @brief Drops the source history: the next output frame is centred on the next source frame,
+	*        with silence ahead of it.
+	*/
+	void reset()
+	{
+		_frac = 0;
+		_need = _taps / 2 + 1;
+		_history_pos = 0;
+		std::fill(&_history[0][0], &_history[0][0] + 2 * 2 * max_tap_count, SOURCE{0});
+	}
+
+	// the taps of each sub-filter, for the configured rates
+	size_t taps() const
+	{
+		return _taps;
+	}
+
+	/**
+	* @brief Moves the ratio off the configured one by ppm, + for a faster pull of the source, so as to
+	*        follow a source clock. Applies from the next output_count on, so between blocks.
+	*/
+	void steer(int32_t ppm)
+	{
+		_step = _nominal_step + (int64_t)_nominal_step * ppm / 1000000;
+	}
+
+	/**
+	* @brief The number of output frames the next input_count source frames complete.
+	*/
+	size_t output_count(size_t input_count) const
+	{
+		if (input_count < _need)
+			return 0;
+
+		return (size_t)((((uint64_t)(input_count - _need) << 32) + 0xffffffffull - _frac) / _step) + 1;
+	}
+
+	/**
+	* @brief Produces count output frames (count <= chunk_size and <= output_count of the rest of
+	*        the block) from channels[..][input_pos..], advancing input_pos.
+	*/
+	void IRAM_ATTR run(const SOURCE *const *channels, size_t &input_pos, size_t count)
+	{
+		if (_narrow)
+			_run<int32_t>(channels, input_pos, count);
+		else
+			_run<int64_t>(channels, input_pos, count);
+	}
+
+	/**
+	* @brief Pushes the rest of a block, that completes no more output frames, into the history.
+	*/
+	void absorb(const SOURCE *const *channels, size_t &input_pos, size_t input_count)
+	{
+		for (; input_pos < input_count; --_need)
+			_push(channels, input_pos++);
+	}
+
+	// planar output of the last run
+	const SOURCE *const *output() const
+	{
+		return _out_channels;
+	}
+
+private:
+	static constexpr const uint8_t _phase_bits = __builtin_ctz(PHASES);
+	static constexpr const uint8_t _weight_bits = 15;  // Q15 interpolation between two phases
+
+	size_t _input_rate;         // of the sub-filters
+	size_t _output_rate;
+	uint8_t _sample_bit_size;
+	uint64_t _step;             // Q32 source samples per output sample
+	uint64_t _nominal_step;     // as configured
+	uint32_t _frac;             // Q32 fractional position of the next output sample
+	uint32_t _need;             // source samples to push before the next output sample
+	uint8_t _channel_count;
+	int32_t _min;
+	int32_t _max;
+	int64_t _gain_max;          // the largest sub-filter L1 norm, Q15
+	bool _narrow;               // 32 bit accumulation
+	size_t _taps;               // of each sub-filter
+	size_t _history_pos;        // oldest sample; the history is stored twice for a contiguous window
+	int16_t _coefs[PHASES + 1][max_tap_count];  // the last phase is the first one, a sample later
+	SOURCE _history[2][2 * max_tap_count];
+	SOURCE _out[2][CHUNK_SIZE];
+	const SOURCE *const _out_channels[2] = {_out[0], _out[1]};
+
+	inline void IRAM_ATTR _push(const SOURCE *const *channels, size_t pos)
+	{
+		for (uint8_t c = 0; c < _channel_count; ++c)
+			_history[c][_history_pos] = _history[c][_history_pos + _taps] = channels[c][pos];
+		if (++_history_pos == _taps)
+			_history_pos = 0;
+	}
+
+	// the sub-filters for the rates, in double precision
+	void _build(size_t input_rate, size_t output_rate)
+	{
+		// cut off at 90% of the lower Nyquist frequency, in cycles per source sample
+		auto cutoff = 0.45 * std::min(1.0, (double)output_rate / input_rate);
+		auto half = (double)_taps / 2;
+		for (size_t p = 0; p <= PHASES; ++p) {
+			double h[max_tap_count];
+			auto sum = 0.0;
+			for (size_t j = 0; j < _taps; ++j) {
+				auto x = half - 1 - j + (double)p / PHASES;
+				auto w = x / half;
+				auto window = (std::abs(w) < 1)? 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2 * M_PI * w) : 0.0;
+				auto sinc = (x == 0)? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+				h[j] = sinc * window;
+				sum += h[j];
+			}
+			for (size_t j = 0; j < _taps; ++j)
+				_coefs[p][j] = (int16_t)lround(h[j] / sum * 32767);
+		}
+
+		// the largest sum a full scale source can reach, rounding included; an interpolated output
+		// lies between those of two phases
+		_gain_max = 0;
+		for (size_t p = 0; p <= PHASES; ++p) {
+			auto gain = int64_t{0};
+			for (size_t j = 0; j < _taps; ++j)
+				gain += std::abs(_coefs[p][j]);
+			_gain_max = std::max(_gain_max, gain);
+		}
+	}
+
+	template<typename ACCUMULATOR>
+	inline void IRAM_ATTR _run(const SOURCE *const *channels, size_t &input_pos, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			for (; _need > 0; --_need)
+				_push(channels, input_pos++);
+
+			auto phase = _frac >> (32 - _phase_bits);
+			auto weight = (int32_t)((_frac >> (32 - _phase_bits - _weight_bits)) & ((1 << _weight_bits) - 1));
+			for (uint8_t c = 0; c < _channel_count; ++c)
+				_out[c][i] = _convolve<ACCUMULATOR>(&_history[c][_history_pos], _coefs[phase], _coefs[phase + 1], weight);
+
+			auto position = (uint64_t)_frac + _step;
+			_frac = (uint32_t)position;
+			_need = (uint32_t)(position >> 32);
+		}
+	}
+
+	// the window through two adjacent phases, in one pass, and their outputs weighed
+	template<typename ACCUMULATOR>
+	inline SOURCE IRAM_ATTR _convolve(const SOURCE *window, const int16_t *coefs, const int16_t *next_coefs,
+										int32_t weight) const
+	{
+		auto acc = ACCUMULATOR{0};
+		auto next_acc = ACCUMULATOR{0};
+		for (size_t j = 0; j < _taps; ++j) {
+			acc += (ACCUMULATOR)window[j] * coefs[j];
+			next_acc += (ACCUMULATOR)window[j] * next_coefs[j];
+		}
+		auto value = (int64_t)acc + (((int64_t)next_acc - acc) * weight >> _weight_bits);
+
+		return (SOURCE)std::clamp<int64_t>((value + (1 << 14)) >> 15, _min, _max);
+	}
+};
+
+
+#endif // PCM56_PLAYER_RESAMPLER
@@ -0,0 +1,215 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_SAMPLE_CONVERT
+#define PCM56_PLAYER_SAMPLE_CONVERT
+
+#include <cmath>
+#include <algorithm>
+#include "player.hh"
+
+/**
+* @name sample convert
+*
+* @brief Decoded block to player buffer conversion kernels: volume, requantisation to the player
+*        sample size, channel interleaving and PCM56 encoding in a single pass.
+*/
+
+
+// volume, in 0.5dB steps
+static constexpr const int16_t player_volume_min = -120;  // -60dB
+static constexpr const int16_t player_volume_max = 12;    // +6dB
+
+
+// Q15 linear gain of 0dB
+static constexpr const int32_t unity_gain = 1 << 15;
+
+
+/**
+* @brief What a gain stage does to each sample: nothing at unity gain, a multiply for gains up to
+*        unity, whose product cannot overflow the sample, and a multiply with saturation above.
+*/
+enum class gain_kind : uint8_t {
+	unity,
+	cut,
+	boost
+};
+
+
+/**
+* @brief Q15 linear gain of the volume (0.5dB steps); 0dB is 32768, +6dB fits in 17 bits.
+*/
+inline int32_t volume_gain(int16_t volume)
+{
+	return (int32_t)lround(32768.0 * pow(10.0, volume / 40.0));
+}
+
+
+/**
+* @brief Per-sample linear gain ramp across a block, Q15 gain with 8 extra fraction bits.
+*/
+struct gain_ramp {
+	int32_t value;
+	int32_t step;
+	gain_kind kind;  // for the whole ramp, both ends being within it
+
+	gain_ramp(int32_t from_gain, int32_t to_gain, size_t count)
+		: value{from_gain << 8}, step{count? (int32_t)(((to_gain - from_gain) << 8) / (int32_t)count) : 0},
+		  kind{((from_gain == unity_gain) && (to_gain == unity_gain))? gain_kind::unity :
+				(std::max(from_gain, to_gain) <= unity_gain)? gain_kind::cut : gain_kind::boost}
+	{}
+
+	inline int32_t next()
+	{
+		auto gain = value >> 8;
+		value += step;
+
+		return gain;
+	}
+
+	// the gain index samples ahead, for kernels that run out of order; advance() past them after
+	inline int32_t at(size_t index) const
+	{
+		return (value + step * (int32_t)index) >> 8;
+	}
+
+	inline void advance(size_t count)
+	{
+		value += step * (int32_t)count;
+	}
+};
+
+
+/**
+* @brief Converts count frames of planar SOURCE samples, starting at offset, into out.
+*
+* Applies the ramped Q15 gain, requantises to the player sample size with saturation, interleaves
+* and encodes in a single pass. The source bit size and the channel count are compile time
+* parameters (SAMPLE_BIT_SIZE 0 stands for any other bit size, given at runtime), and so is the
+* kind of gain: unity gain is a plain requantisation, and only gains above unity saturate. The
+* samples are brought to 16 bits ahead of the gain, so that the product fits 32 bits at any source
+* size, up to the +6dB gain. Mono sources are played on both channels.
+*/
+template<typename SOURCE, uint8_t SAMPLE_BIT_SIZE, uint8_t CHANNEL_COUNT, gain_kind GAIN>
+struct block_converter {
+	static_assert((CHANNEL_COUNT == 1) || (CHANNEL_COUNT == 2), "block_converter: mono or stereo only");
+
+	static inline void convert(const SOURCE *const *channels, size_t offset, encoded_sample_type *out, size_t count,
+									gain_ramp &ramp, uint8_t sample_bit_size)
+	{
+		const SOURCE *ch0 = channels[0] + offset;
+		const SOURCE *ch1 = channels[CHANNEL_COUNT - 1] + offset;
+
+		if constexpr (GAIN == gain_kind::unity) {
+			for (size_t i = 0; i < count; ++i)
+				out[i] = pcm56_encoding::encode(normalise(ch0[i], sample_bit_size), normalise(ch1[i], sample_bit_size));
+			return;
+		}
+
+		// a local ramp: the words written to out could otherwise alias it, and reload it each time
+		auto local_ramp = ramp;
+		for (size_t i = 0; i < count; ++i) {
+			auto gain = local_ramp.next();
+			out[i] = pcm56_encoding::encode(scale(normalise(ch0[i], sample_bit_size), gain),
+											scale(normalise(ch1[i], sample_bit_size), gain));
+		}
+		ramp = local_ramp;
+	}
+
+	// the sample as a 16 bit one
+	static inline int32_t normalise(SOURCE value, uint8_t sample_bit_size)
+	{
+		if constexpr (SAMPLE_BIT_SIZE == 16)
+			return (int32_t)value;
+		else if constexpr (SAMPLE_BIT_SIZE > 16)
+			return (int32_t)value >> (SAMPLE_BIT_SIZE - 16);
+		else if (sample_bit_size >= 16)
+			return (int32_t)value >> (sample_bit_size - 16);
+		else
+			return (int32_t)value << (16 - sample_bit_size);
+	}
+
+	// the normalised sample times the Q15 gain
+	static inline player_sample_type scale(int32_t value, int32_t gain)
+	{
+		if constexpr (GAIN == gain_kind::unity)
+			return (player_sample_type)value;
+		else if constexpr (GAIN == gain_kind::cut)
+			return (player_sample_type)(value * gain >> 15);
+		else
+			return _saturate(value * gain >> 15);
+	}
+
+private:
+	static inline player_sample_type _saturate(int32_t value)
+	{
+		return (player_sample_type)std::clamp<int32_t>(value, INT16_MIN, INT16_MAX);
+	}
+};
+
+
+/**
+* @brief Conversion of one decoded block: the kernel matching the source and the gain ramp from
+*        the previous block's gain to the current one, spread over the whole block.
+*
+* The kernel is picked on each call, by branches that go the same way all through the block, and
+* inlined into it.
+*/
+template<typename SOURCE>
+class block_conversion {
+public:
+	block_conversion(uint8_t channel_count, uint8_t sample_bit_size, int32_t from_gain, int32_t to_gain, size_t block_size)
+		: _channel_count{channel_count}, _sample_bit_size{sample_bit_size}, _ramp{from_gain, to_gain, block_size}
+	{}
+
+	inline void operator()(const SOURCE *const *channels, size_t offset, encoded_sample_type *out, size_t count)
+	{
+		if (_ramp.kind == gain_kind::unity)
+			_convert<gain_kind::unity>(channels, offset, out, count);
+		else if (_ramp.kind == gain_kind::cut)
+			_convert<gain_kind::cut>(channels, offset, out, count);
+		else
+			_convert<gain_kind::boost>(channels, offset, out, count);
+	}
+
+private:
+	uint8_t _channel_count;
+	uint8_t _sample_bit_size;
+	gain_ramp _ramp;
+
+	template<gain_kind GAIN>
+	inline void _convert(const SOURCE *const *channels, size_t offset, encoded_sample_type *out, size_t count)
+	{
+		if (_channel_count == 1)
+			_convert<GAIN, 1>(channels, offset, out, count);
+		else
+			_convert<GAIN, 2>(channels, offset, out, count);
+	}
+
+	template<gain_kind GAIN, uint8_t CHANNEL_COUNT>
+	inline void _convert(const SOURCE *const *channels, size_t offset, encoded_sample_type *out, size_t count)
+	{
+		if (_sample_bit_size == 16)
+			block_converter<SOURCE, 16, CHANNEL_COUNT, GAIN>::convert(channels, offset, out, count, _ramp, _sample_bit_size);
+		else if (_sample_bit_size == 24)
+			block_converter<SOURCE, 24, CHANNEL_COUNT, GAIN>::convert(channels, offset, out, count, _ramp, _sample_bit_size);
+		else
+			block_converter<SOURCE, 0, CHANNEL_COUNT, GAIN>::convert(channels, offset, out, count, _ramp, _sample_bit_size);
+	}
+};
+
+
+#endif // PCM56_PLAYER_SAMPLE_CONVERT
@@ -0,0 +1,425 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef READ_AHEAD
+#define READ_AHEAD
+
+#include <stdio.h>
+#include <atomic>
+#include <istream>
+#include <cstring>
+#include <streambuf>
+#include <string_view>
+#include <stdexcept>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include <basics/error.hh>
+
+/**
+* @name read_ahead
+*
+* @brief Asynchronous file read-ahead: a reader task streams the open file into a ring of blocks
+*        ahead of the consumer, which reads through a std::istream.
+*/
+
+
+/**
+* @brief Reader counters, written by the reader task and the consumer, readable from any task.
+*
+* Read latencies go into a histogram with a bucket per power of two microseconds (bucket i counts
+* reads that took [2^i, 2^(i+1)) us); percentile() reports the upper bound of a bucket.
+*/
+struct read_ahead_stats {
+	static constexpr const size_t bucket_count = 20;  // up to ~1s
+
+	std::atomic<uint32_t> fill{0};              // bytes read ahead of the consumer
+	std::atomic<uint32_t> read_count{0};
+	std::atomic<uint32_t> byte_count{0};
+	std::atomic<uint32_t> busy_us{0};           // time spent reading
+	std::atomic<uint32_t> max_us{0};
+	std::atomic<uint32_t> error_count{0};
+	std::atomic<uint32_t> stall_count{0};       // consumer reads that had to wait for the reader
+	std::atomic<uint32_t> histogram[bucket_count]{};
+
+	void reset()
+	{
+		read_count.store(0, std::memory_order_relaxed);
+		byte_count.store(0, std::memory_order_relaxed);
+		busy_us.store(0, std::memory_order_relaxed);
+		max_us.store(0, std::memory_order_relaxed);
+		error_count.store(0, std::memory_order_relaxed);
+		stall_count.store(0, std::memory_order_relaxed);
+		for (auto &bucket : histogram)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+
+	void record_read(size_t size, uint32_t us)
+	{
+		fill.fetch_add(size, std::memory_order_relaxed);
+		read_count.fetch_add(1, std::memory_order_relaxed);
+		byte_count.fetch_add(size, std::memory_order_relaxed);
+		busy_us.fetch_add(us, std::memory_order_relaxed);
+		if (us > max_us.load(std::memory_order_relaxed))
+			max_us.store(us, std::memory_order_relaxed);
+
+		auto bucket = (us == 0)? 0 : std::min<size_t>(31 - __builtin_clz(us), bucket_count - 1);
+		histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// upper bound, in us, of the read latency percentile (0..100)
+	uint32_t percentile(uint32_t percent) const
+	{
+		auto total = read_count.load(std::memory_order_relaxed);
+		auto count = uint32_t{0};
+		for (size_t i = 0; i < bucket_count; ++i) {
+			count += histogram[i].load(std::memory_order_relaxed);
+			if ((uint64_t)count * 100 >= (uint64_t)total * percent)
+				return (2u << i) - 1;
+		}
+
+		return max_us.load(std::memory_order_relaxed);
+	}
+
+	// achieved read throughput, in bytes/second of reading time
+	uint32_t throughput() const
+	{
+		auto us = busy_us.load(std::memory_order_relaxed);
+
+		return us? (uint32_t)((uint64_t)byte_count.load(std::memory_order_relaxed) * 1000000 / us) : 0;
+	}
+};
+
+
+/**
+* @brief Ring of BLOCK_COUNT DMA capable blocks of BLOCK_SIZE bytes, filled by a reader task.
+*
+* The files are read unbuffered, in whole blocks, so that with a sector multiple BLOCK_SIZE the
+* FAT driver transfers straight into the (word aligned) blocks, through no sector cache of its
+* own. The get area of the stream is the block itself, and underflow() is the refill at block
+* boundaries: the consumer reads the bytes where the SD driver put them. The FLAC decoder takes them
+* through the bit reader of the stream library, outside this tree: that reader is not fed from the
+* blocks in place, it reads them through the istream interface. Full blocks are handed over
+* through a counting semaphore, and given back through another one once consumed; a short block
+* marks the end of a file, an empty one follows it.
+*
+* Files are queued: the reader task goes on with the next queued file as soon as it is done with
+* the current one, so the ring runs straight from the end of a file into the start of the next.
+* The consumer moves to the next file with next(), skipping what it left of the current one;
+* close() drops everything. The reader task lives as long as the object.
+*
+* A file may be queued from an offset, behind a few bytes of head, seen by the consumer as the start
+* of the file: a FLAC stream resumes at a frame behind its STREAMINFO. The head takes a block of its
+* own, and the first read is cut short so that the next ones are block aligned in the file.
+*/
+template<size_t BLOCK_SIZE, size_t BLOCK_COUNT>
+class read_ahead_buffer : public std::streambuf {
+public:
+	static_assert(BLOCK_SIZE % 512 == 0, "read_ahead_buffer: BLOCK_SIZE must be a multiple of the sector size");
+
+	static constexpr const size_t block_size = BLOCK_SIZE;
+	static constexpr const size_t block_count = BLOCK_COUNT;
+
+	read_ahead_buffer(read_ahead_stats &stats, uint8_t core, UBaseType_t priority)
+		: _stats{stats}, _blocks{}, _sizes{}, _write_index{0}, _read_index{0}, _holding{false}, _in_file{false},
+		  _eof{false}, _queued{false}, _closing{false}, _quit{false}, _files{nullptr}, _idle{nullptr},
+		  _filled{nullptr}, _free{nullptr}, _task{nullptr}
+	{
+		for (auto &block : _blocks) {
+			block = (char *)heap_caps_aligned_alloc(4, BLOCK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+			if (block == nullptr)
+				throw std::runtime_error("read_ahead_buffer: DMA buffer allocation failure");
+		}
+
+		// the file being read, one queued next, and the close request (no file)
+		_files = xQueueCreate(_file_queue_size + 1, sizeof(queued_file));
+		_idle = xSemaphoreCreateBinary();
+		_filled = xSemaphoreCreateCounting(BLOCK_COUNT, 0);
+		_free = xSemaphoreCreateCounting(BLOCK_COUNT + 1, BLOCK_COUNT);  // + the wake up on close
+		if ((_files == nullptr) || (_idle == nullptr) || (_filled == nullptr) || (_free == nullptr))
+			throw std::runtime_error("read_ahead_buffer: queue allocation failure");
+
+		if (xTaskCreatePinnedToCore(&read_ahead_buffer<BLOCK_SIZE, BLOCK_COUNT>::_read, "read_ahead", 4096, this,
+										priority, &_task, core) != pdPASS)
+			throw std::runtime_error("read_ahead_buffer: task creation failure");
+	}
+	read_ahead_buffer(const read_ahead_buffer&) = delete;
+	read_ahead_buffer(read_ahead_buffer&& other) = delete;
+
+	read_ahead_buffer& operator=(const read_ahead_buffer&) = delete;
+	read_ahead_buffer& operator=(read_ahead_buffer&& other) = delete;
+
+	~read_ahead_buffer()
+	{
+		close();
+
+		_quit = true;
+		_request_close();
+
+		vSemaphoreDelete(_free);
+		vSemaphoreDelete(_filled);
+		vSemaphoreDelete(_idle);
+		vQueueDelete(_files);
+		for (auto &block : _blocks)
+			heap_caps_free(block);
+	}
+
+	/**
+	* @brief Opens the file and queues it for reading after the ones already queued, from the offset
+	*        and behind the head.
+	*/
+	void queue(const char *path, long offset = 0, std::string_view head = {})
+	{
+		if (head.size() > head_max_size)
+			throw std::runtime_error("read_ahead_buffer: head too large");
+
+		queued_file item{::fopen(path, "rb"), (uint8_t)head.size(), {}};
+		if (item.file == nullptr)
+			throw basics::error{"read_ahead: failed opening '%s'", path};
+		setvbuf(item.file, nullptr, _IONBF, 0);
+		head.copy(item.head, head.size());
+
+		if ((offset != 0) && (::fseek(item.file, offset, SEEK_SET) != 0)) {
+			::fclose(item.file);
+			throw basics::error{"read_ahead: failed seeking '%s'", path};
+		}
+		if (uxQueueSpacesAvailable(_files) <= 1) {
+			::fclose(item.file);
+			throw std::runtime_error("read_ahead_buffer: too many files queued");
+		}
+		xQueueSend(_files, &item, 0);
+		_queued = true;
+	}
+
+	/**
+	* @brief Moves the consumer to the start of the next queued file.
+	*/
+	void next()
+	{
+		while (_in_file && !_eof)
+			_next_block();
+
+		_in_file = true;
+		_eof = false;
+		setg(nullptr, nullptr, nullptr);
+	}
+
+	/**
+	* @brief Stops the reader and drops the queued files and the blocks read ahead.
+	*/
+	void close()
+	{
+		if (!_queued)
+			return;
+
+		_closing = true;
+		_request_close();
+
+		while (xSemaphoreTake(_filled, 0) == pdTRUE)
+			;
+		while (uxSemaphoreGetCount(_free) > BLOCK_COUNT)
+			xSemaphoreTake(_free, 0);
+		while (uxSemaphoreGetCount(_free) < BLOCK_COUNT)
+			xSemaphoreGive(_free);
+
+		_write_index = 0;
+		_read_index = 0;
+		_holding = false;
+		_in_file = false;
+		_eof = false;
+		_queued = false;
+		_closing = false;
+		setg(nullptr, nullptr, nullptr);
+		_stats.fill.store(0, std::memory_order_relaxed);
+	}
+
+protected:
+	// bytes readable without blocking: what the reader task has filled ahead of the get area
+	std::streamsize showmanyc() override
+	{
+		if (_eof || !_in_file)
+			return -1;
+
+		return uxSemaphoreGetCount(_filled) * BLOCK_SIZE;
+	}
+
+	int_type underflow() override
+	{
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		if (_eof || !_in_file || !_next_block())
+			return traits_type::eof();
+
+		return traits_type::to_int_type(*gptr());
+	}
+
+	static constexpr const size_t head_max_size = 48;
+
+private:
+	static constexpr const size_t _file_queue_size = 2;
+
+	struct queued_file {
+		FILE *file;  // nullptr for the close request
+		uint8_t head_size;
+		char head[head_max_size];
+	};
+
+	read_ahead_stats &_stats;
+	char *_blocks[BLOCK_COUNT];
+	size_t _sizes[BLOCK_COUNT];
+	size_t _write_index;                  // reader task
+	size_t _read_index;                   // consumer
+	bool _holding;                        // the consumer holds the block at _read_index
+	bool _in_file;
+	bool _eof;
+	bool _queued;                         // files were queued since the last close
+	volatile bool _closing;
+	volatile bool _quit;
+	QueueHandle_t _files;
+	SemaphoreHandle_t _idle;
+	SemaphoreHandle_t _filled;
+	SemaphoreHandle_t _free;
+	TaskHandle_t _task;
+
+	// releases the block held, if any, and gets the next one; false at the end of the file
+	bool _next_block()
+	{
+		if (_holding) {
+			_stats.fill.fetch_sub(_sizes[_read_index], std::memory_order_relaxed);
+			_read_index = (_read_index + 1) % BLOCK_COUNT;
+			xSemaphoreGive(_free);
+			_holding = false;
+		}
+
+		if (xSemaphoreTake(_filled, 0) != pdTRUE) {
+			_stats.stall_count.fetch_add(1, std::memory_order_relaxed);
+			xSemaphoreTake(_filled, portMAX_DELAY);
+		}
+		_holding = true;
+
+		auto *block = _blocks[_read_index];
+		auto size = _sizes[_read_index];
+		setg(block, block, block + size);
+		_eof = (size == 0);
+
+		return !_eof;
+	}
+
+	// wakes the reader up, wherever it waits, and waits for it to drop its files
+	void _request_close()
+	{
+		queued_file request{nullptr, 0, {}};
+
+		// the request goes ahead of the queued files before the reader can move on to one of them
+		xQueueSendToFront(_files, &request, portMAX_DELAY);
+		xSemaphoreGive(_free);
+		xSemaphoreTake(_idle, portMAX_DELAY);
+	}
+
+	// returns on the end of the file or on a close request
+	void _read_file(const queued_file &item)
+	{
+		if (item.head_size != 0) {
+			xSemaphoreTake(_free, portMAX_DELAY);
+			if (_closing)
+				return;
+
+			memcpy(_blocks[_write_index], item.head, item.head_size);
+			_sizes[_write_index] = item.head_size;
+			_stats.fill.fetch_add(item.head_size, std::memory_order_relaxed);
+			_write_index = (_write_index + 1) % BLOCK_COUNT;
+			xSemaphoreGive(_filled);
+		}
+
+		auto read_size = BLOCK_SIZE - (size_t)::ftell(item.file) % BLOCK_SIZE;
+		for (;;) {
+			xSemaphoreTake(_free, portMAX_DELAY);
+			if (_closing)
+				return;
+
+			auto index = _write_index;
+			auto start = esp_timer_get_time();
+			auto size = ::fread(_blocks[index], 1, read_size, item.file);
+			_stats.record_read(size, (uint32_t)(esp_timer_get_time() - start));
+			if ((size < read_size) && ::ferror(item.file))
+				_stats.error_count.fetch_add(1, std::memory_order_relaxed);
+
+			_sizes[index] = size;
+			_write_index = (index + 1) % BLOCK_COUNT;
+			xSemaphoreGive(_filled);
+
+			if (size == 0)
+				return;  // the empty block marks the end of the file
+			read_size = BLOCK_SIZE;
+		}
+	}
+
+	static void _read(void *arg)
+	{
+		auto *self = (read_ahead_buffer<BLOCK_SIZE, BLOCK_COUNT> *)arg;
+
+		for (;;) {
+			queued_file item{};
+			xQueueReceive(self->_files, &item, portMAX_DELAY);
+
+			if (item.file != nullptr) {
+				self->_read_file(item);
+				::fclose(item.file);
+
+				continue;
+			}
+
+			// close request: drop the files queued behind it
+			while (xQueueReceive(self->_files, &item, 0) == pdTRUE) {
+				if (item.file != nullptr)
+					::fclose(item.file);
+			}
+			if (self->_quit)
+				break;
+			xSemaphoreGive(self->_idle);
+		}
+
+		xSemaphoreGive(self->_idle);
+		vTaskDelete(nullptr);
+	}
+};
+
+
+/**
+* @brief Input stream over the next file of the read_ahead_buffer.
+*/
+template<typename BUFFER>
+class read_ahead_input : public std::istream {
+public:
+	explicit read_ahead_input(BUFFER &buffer)
+		: std::istream{&buffer}
+	{
+		buffer.next();
+	}
+	read_ahead_input(const read_ahead_input&) = delete;
+	read_ahead_input(read_ahead_input&& other) = delete;
+
+	read_ahead_input& operator=(const read_ahead_input&) = delete;
+	read_ahead_input& operator=(read_ahead_input&& other) = delete;
+
+	~read_ahead_input() = default;
+};
+
+
+#endif // READ_AHEAD
@@ -18,9 +18,15 @@
 #define STREAM_BUFFER
 
 #include <stdio.h>
+#include <cstring>
 #include <stdexcept>
 #include <optional>
+#include <algorithm>
+#include <atomic>
+#include <span>
+#include <type_traits>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/stream_buffer.h"
 
 /**
@@ -56,33 +62,67 @@ private:
 };
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
+/**
+* @brief Lock-free single-producer/single-consumer ring of SLOT_COUNT slots of SLOT_SIZE values.
+*
+* The producer (task) and the consumer (ISR) each own one free-running index; the other side only
+* reads it, with acquire/release ordering, so no critical section is needed on either side. The
+* total capacity must be a power of two. need_data() reports whether at least one whole slot is
+* free, which lets the producer write in slot-sized batches instead of refilling a whole half of
+* a ping-pong buffer inside one half's playback time. A producer task can block in wait_space()
+* until the consumer, calling notify_space() after its reads, has freed a slot.
+*/
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT = 2>
 class stream_buffer {
 public:
+	static constexpr const size_t capacity = SLOT_SIZE * SLOT_COUNT;
+	static_assert((capacity != 0) && ((capacity & (capacity - 1)) == 0),
+					"stream_buffer: capacity must be a power of two");
+
 	stream_buffer();
 	stream_buffer(const stream_buffer&) = delete;
 
 	stream_buffer& operator=(const stream_buffer&) = delete;
 
+	// not thread safe: call only while the consumer is stopped
 	void reset();
 
+	// consumer side
 	template<typename OPERATION_POLICY>
 	inline std::optional<VALUE_TYPE> get();
 
+	inline std::span<const VALUE_TYPE> peek() const;
+
+	inline void consume(size_t count);
+
+	template<typename OPERATION_POLICY>
+	inline bool notify_space();
+
+	// producer side
 	template<typename OPERATION_POLICY>
-	inline void put(VALUE_TYPE value);
+	inline bool put(VALUE_TYPE value);
+
+	inline size_t put_span(std::span<const VALUE_TYPE> values);
 
-	inline bool need_data();
+	template<typename FILL>
+	inline size_t put_block(size_t count, FILL &&fill);
+
+	inline bool need_data() const;
+
+	inline bool wait_space(TickType_t timeout);
+
+	// either side
+	inline size_t size() const;
+
+	inline size_t available() const;
 
 private:
-	static const constexpr size_t _max_count = 2;
-
-	VALUE_TYPE _buffer[_max_count][MAX_SIZE];
-	uint16_t _limit[_max_count];
-	uint8_t _read_idx;
-	uint16_t _read_pos;
-	uint8_t _write_idx;
-	bool _need_data;
+	static const constexpr size_t _mask = capacity - 1;
+
+	VALUE_TYPE _buffer[capacity];
+	std::atomic<size_t> _write_pos;
+	std::atomic<size_t> _read_pos;
+	std::atomic<TaskHandle_t> _waiting_task;
 };
 
 
@@ -92,12 +132,28 @@ class task_operation {
 public:
 	static size_t receive(StreamBufferHandle_t stream_buffer, void *buffer, size_t buffer_size);
 	static size_t send(StreamBufferHandle_t stream_buffer, void *data, size_t size);
+
+	static inline bool notify(TaskHandle_t task)
+	{
+		xTaskNotifyGive(task);
+
+		return false;
+	}
 };
 
 class isr_operation {
 public:
 	static size_t receive(StreamBufferHandle_t stream_buffer, void *buffer, size_t buffer_size);
 	static size_t send(StreamBufferHandle_t stream_buffer, void *data, size_t size);
+
+	// returns whether a higher priority task was woken
+	static inline bool notify(TaskHandle_t task)
+	{
+		BaseType_t task_woken = pdFALSE;
+		vTaskNotifyGiveFromISR(task, &task_woken);
+
+		return (task_woken == pdTRUE);
+	}
 };
 
 
@@ -177,71 +233,176 @@ inline size_t stream_buffer_rtos<MAX_SIZE, TRIGGER>::_put_data(void *data, size_
 }
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
-stream_buffer<VALUE_TYPE, MAX_SIZE>::stream_buffer()
-	: _buffer{}, _limit{MAX_SIZE, MAX_SIZE}, _read_idx{0}, _read_pos{0}, _write_idx{1},
-		_need_data{true}
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::stream_buffer()
+	: _buffer{}, _write_pos{0}, _read_pos{0}, _waiting_task{nullptr}
+{}
+
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+void stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::reset()
 {
-	memset(_buffer, 0, sizeof(_buffer));
+	_write_pos.store(0, std::memory_order_relaxed);
+	_read_pos.store(0, std::memory_order_release);
 }
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
-void stream_buffer<VALUE_TYPE, MAX_SIZE>::reset()
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+template<typename OPERATION_POLICY>
+inline std::optional<VALUE_TYPE> stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::get()
 {
-	memset(_buffer, 0, sizeof(_buffer));
+	auto read_pos = _read_pos.load(std::memory_order_relaxed);
+	if (read_pos == _write_pos.load(std::memory_order_acquire))
+		return std::nullopt;
 
-	for (size_t i = 0; i < _max_count; ++i)
-		_limit[i] = MAX_SIZE;
+	auto value = _buffer[read_pos & _mask];
+	_read_pos.store(read_pos + 1, std::memory_order_release);
 
-	_read_idx = 0;
-	_read_pos = 0;
-	_write_idx = 1;
-
-	_need_data = true;
+	return value;
 }
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
+/**
+* @brief Wakes the producer waiting in wait_space() once a whole slot is free, at most once per
+*        wait. Returns whether a higher priority task was woken (see OPERATION_POLICY::notify).
+*/
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
 template<typename OPERATION_POLICY>
-inline std::optional<VALUE_TYPE> stream_buffer<VALUE_TYPE, MAX_SIZE>::get()
+inline bool stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::notify_space()
 {
-	if (_read_pos >= _limit[_read_idx]) {
-		_read_idx = (_read_idx + 1) % _max_count;
-		_read_pos = 0;
+	// orders the read position update before the waiter check, against the one in wait_space
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if ((_waiting_task.load(std::memory_order_relaxed) == nullptr) || !need_data())
+		return false;
 
-		_write_idx = (_read_idx + 1) % _max_count;
+	auto task = _waiting_task.exchange(nullptr, std::memory_order_acq_rel);
 
-		_need_data = true;
-	}
+	return (task != nullptr) && OPERATION_POLICY::notify(task);
+}
+
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline std::span<const VALUE_TYPE> stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::peek() const
+{
+	auto read_pos = _read_pos.load(std::memory_order_relaxed);
+	auto count = _write_pos.load(std::memory_order_acquire) - read_pos;
+	auto offset = read_pos & _mask;
+
+	return {&_buffer[offset], std::min(count, capacity - offset)};
+}
 
-	return _buffer[_read_idx][_read_pos++];
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline void stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::consume(size_t count)
+{
+	_read_pos.store(_read_pos.load(std::memory_order_relaxed) + count, std::memory_order_release);
 }
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
 template<typename OPERATION_POLICY>
-inline void stream_buffer<VALUE_TYPE, MAX_SIZE>::put(VALUE_TYPE value)
+inline bool stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::put(VALUE_TYPE value)
 {
-	if (_limit[_write_idx] >= MAX_SIZE)
-		return;
+	auto write_pos = _write_pos.load(std::memory_order_relaxed);
+	if (write_pos - _read_pos.load(std::memory_order_acquire) >= capacity)
+		return false;
+
+	_buffer[write_pos & _mask] = value;
+	_write_pos.store(write_pos + 1, std::memory_order_release);
 
-	_buffer[_write_idx][_limit[_write_idx]++] = value;
+	return true;
 }
 
 
-template<typename VALUE_TYPE, size_t MAX_SIZE>
-inline bool stream_buffer<VALUE_TYPE, MAX_SIZE>::need_data()
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline size_t stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::put_span(std::span<const VALUE_TYPE> values)
 {
-	if (_need_data) {
-		_limit[_write_idx] = 0;
+	auto write_pos = _write_pos.load(std::memory_order_relaxed);
+	auto count = std::min(values.size(), capacity - (write_pos - _read_pos.load(std::memory_order_acquire)));
+	auto offset = write_pos & _mask;
+	auto head_count = std::min(count, capacity - offset);
 
-		_need_data = false;
+	memcpy(&_buffer[offset], values.data(), head_count * sizeof(VALUE_TYPE));
+	memcpy(&_buffer[0], values.data() + head_count, (count - head_count) * sizeof(VALUE_TYPE));
+	_write_pos.store(write_pos + count, std::memory_order_release);
 
-		return true;
+	return count;
+}
+
+
+/**
+* @brief Lets fill(VALUE_TYPE *data, size_t count) write up to count values in place, in at most two
+*        contiguous runs, and publishes them at once. Returns the number of values written.
+*
+* A fill that returns a size_t tells the values it wrote, from data on: one short of its count ends
+* the block there, and only the values written are published, for a source that runs dry.
+*/
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+template<typename FILL>
+inline size_t stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::put_block(size_t count, FILL &&fill)
+{
+	auto write_pos = _write_pos.load(std::memory_order_relaxed);
+	count = std::min(count, capacity - (write_pos - _read_pos.load(std::memory_order_acquire)));
+	auto offset = write_pos & _mask;
+	auto head_count = std::min(count, capacity - offset);
+
+	if constexpr (std::is_void_v<std::invoke_result_t<FILL, VALUE_TYPE *, size_t>>) {
+		fill(&_buffer[offset], head_count);
+		if (count > head_count)
+			fill(&_buffer[0], count - head_count);
+	} else {
+		auto written = (size_t)fill(&_buffer[offset], head_count);
+		if ((written == head_count) && (count > head_count))
+			written += fill(&_buffer[0], count - head_count);
+		count = written;
 	}
+	_write_pos.store(write_pos + count, std::memory_order_release);
+
+	return count;
+}
+
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline bool stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::need_data() const
+{
+	return (available() >= SLOT_SIZE);
+}
 
-	return false;
+
+/**
+* @brief Blocks the calling task until need_data(), the timeout or any other notification of the
+*        task (spurious wake ups are possible, the caller re-checks). Returns need_data().
+*/
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline bool stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::wait_space(TickType_t timeout)
+{
+	if (need_data())
+		return true;
+
+	_waiting_task.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// the consumer may have freed the slot before it could see the waiter
+	if (!need_data())
+		ulTaskNotifyTake(pdTRUE, timeout);
+	_waiting_task.store(nullptr, std::memory_order_relaxed);
+
+	return need_data();
+}
+
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline size_t stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::size() const
+{
+	auto read_pos = _read_pos.load(std::memory_order_acquire);
+
+	return _write_pos.load(std::memory_order_acquire) - read_pos;
+}
+
+
+template<typename VALUE_TYPE, size_t SLOT_SIZE, size_t SLOT_COUNT>
+inline size_t stream_buffer<VALUE_TYPE, SLOT_SIZE, SLOT_COUNT>::available() const
+{
+	return capacity - size();
 }
 
 
@@ -0,0 +1,152 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_CHUNKED_RESPONSE
+#define PCM56_PLAYER_CHUNKED_RESPONSE
+
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include "esp_http_server.h"
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player chunked response
+*
+* @brief HTTP response body written through a fixed buffer, sent in chunks as it fills up.
+*/
+
+
+// a string written as JSON string content: quotes and backslashes escaped, control characters blanked
+struct json_text {
+	std::string_view value;
+};
+
+
+/**
+* @brief Streams the response body in chunks of up to BUFFER_SIZE bytes, in constant memory.
+*
+* The headers are sent along with the first chunk: they are to be set before the first write that
+* fills the buffer. After a send failure (the client is gone) the rest is dropped and finish()
+* reports the error. A response that cannot be completed ends through fail().
+*/
+template<size_t BUFFER_SIZE = 512>
+class chunked_response {
+public:
+	explicit chunked_response(httpd_req_t *req)
+		: _req{req}, _buffer{}, _size{0}, _sent{false}, _error{ESP_OK}
+	{}
+	chunked_response(const chunked_response&) = delete;
+	chunked_response(chunked_response&& other) = delete;
+
+	chunked_response& operator=(const chunked_response&) = delete;
+	chunked_response& operator=(chunked_response&& other) = delete;
+
+	~chunked_response() = default;
+
+	chunked_response &operator<<(std::string_view value)
+	{
+		while (!value.empty()) {
+			if (_size == BUFFER_SIZE)
+				_flush();
+
+			auto count = std::min(value.size(), BUFFER_SIZE - _size);
+			memcpy(&_buffer[_size], value.data(), count);
+			_size += count;
+			value.remove_prefix(count);
+		}
+
+		return *this;
+	}
+
+	chunked_response &operator<<(const char *value)
+	{
+		return *this << std::string_view{value};
+	}
+
+	template<typename VALUE>
+		requires std::is_integral_v<VALUE>
+	chunked_response &operator<<(VALUE value)
+	{
+		char data[24];
+		auto res = std::to_chars(data, data + sizeof(data), value);
+
+		return *this << std::string_view{data, (size_t)(res.ptr - data)};
+	}
+
+	chunked_response &operator<<(json_text text)
+	{
+		for (auto c : text.value) {
+			if ((c == '"') || (c == '\\'))
+				*this << std::string_view{"\\", 1};
+			if ((unsigned char)c < 0x20)
+				c = ' ';
+			*this << std::string_view{&c, 1};
+		}
+
+		return *this;
+	}
+
+	/**
+	* @brief Sends what is left and ends the response.
+	*/
+	esp_err_t finish()
+	{
+		_flush();
+		if (_error == ESP_OK)
+			_error = httpd_resp_send_chunk(_req, nullptr, 0);
+
+		return _error;
+	}
+
+	/**
+	* @brief Ends a response that cannot be completed: with the message as the whole body when no
+	* chunk went out yet; otherwise with ESP_FAIL, for the server to drop the connection mid body,
+	* since a chunk terminator would pass the truncated body for a complete one.
+	*/
+	esp_err_t fail(const char *message)
+	{
+		if (_sent)
+			return ESP_FAIL;
+
+		_size = 0;
+		return httpd_resp_sendstr(_req, message);
+	}
+
+private:
+	httpd_req_t *_req;
+	char _buffer[BUFFER_SIZE];
+	size_t _size;
+	bool _sent;      // a chunk, and with it the headers, went out
+	esp_err_t _error;
+
+	void _flush()
+	{
+		if ((_size != 0) && (_error == ESP_OK)) {
+			_sent = true;
+			_error = httpd_resp_send_chunk(_req, _buffer, _size);
+		}
+		_size = 0;
+	}
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_CHUNKED_RESPONSE
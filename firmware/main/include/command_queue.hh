@@ -0,0 +1,154 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_COMMAND_QUEUE
+#define PCM56_PLAYER_COMMAND_QUEUE
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player command queue
+*
+* @brief Commands from the HTTP handlers to the player, and their response latencies.
+*/
+
+
+/**
+* @brief Bounded lock-free multi-producer/single-consumer queue of CAPACITY values.
+*
+* Each cell carries a sequence number telling whether it is free for the producer at a given
+* position or filled for the consumer (D. Vyukov's bounded queue): producers claim positions with
+* a compare-and-swap, the consumer owns its position. The consumer role may pass from one task to
+* another, provided the handover itself is synchronised.
+*/
+template<typename VALUE, size_t CAPACITY>
+class mpsc_queue {
+public:
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "mpsc_queue: CAPACITY must be a power of two");
+
+	mpsc_queue()
+		: _cells{}, _push_pos{0}, _pop_pos{0}
+	{
+		for (size_t i = 0; i < CAPACITY; ++i)
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue(mpsc_queue&& other) = delete;
+
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(mpsc_queue&& other) = delete;
+
+	// producers; false when full
+	bool push(VALUE &&value)
+	{
+		auto pos = _push_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			auto &cell = _cells[pos & _mask];
+			auto diff = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+			if (diff < 0)
+				return false;
+
+			if (diff > 0) {
+				pos = _push_pos.load(std::memory_order_relaxed);
+			} else if (_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell.value = std::move(value);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+
+				return true;
+			}
+		}
+	}
+
+	// consumer
+	std::optional<VALUE> pop()
+	{
+		auto &cell = _cells[_pop_pos & _mask];
+		if (cell.sequence.load(std::memory_order_acquire) != _pop_pos + 1)
+			return std::nullopt;
+
+		auto value = std::move(cell.value);
+		cell.sequence.store(_pop_pos + CAPACITY, std::memory_order_release);
+		++_pop_pos;
+
+		return value;
+	}
+
+	// consumer
+	bool empty() const
+	{
+		return (_cells[_pop_pos & _mask].sequence.load(std::memory_order_acquire) != _pop_pos + 1);
+	}
+
+private:
+	static constexpr const size_t _mask = CAPACITY - 1;
+
+	struct cell_type {
+		std::atomic<size_t> sequence;
+		VALUE value;
+	};
+
+	cell_type _cells[CAPACITY];
+	std::atomic<size_t> _push_pos;
+	size_t _pop_pos;
+};
+
+
+/**
+* @brief Response latencies of one command type, in microseconds: from the request to its effect.
+*/
+struct command_latency {
+	std::atomic<uint32_t> count{0};
+	std::atomic<uint32_t> last_us{0};
+	std::atomic<uint32_t> max_us{0};
+	std::atomic<uint64_t> total_us{0};
+
+	void reset()
+	{
+		count.store(0, std::memory_order_relaxed);
+		last_us.store(0, std::memory_order_relaxed);
+		max_us.store(0, std::memory_order_relaxed);
+		total_us.store(0, std::memory_order_relaxed);
+	}
+
+	void record(int64_t latency_us)
+	{
+		auto value = (uint32_t)std::max<int64_t>(latency_us, 0);
+		count.fetch_add(1, std::memory_order_relaxed);
+		last_us.store(value, std::memory_order_relaxed);
+		total_us.fetch_add(value, std::memory_order_relaxed);
+		if (value > max_us.load(std::memory_order_relaxed))
+			max_us.store(value, std::memory_order_relaxed);
+	}
+
+	uint32_t mean_us() const
+	{
+		auto n = count.load(std::memory_order_relaxed);
+
+		return n? (uint32_t)(total_us.load(std::memory_order_relaxed) / n) : 0;
+	}
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_COMMAND_QUEUE
@@ -68,7 +68,7 @@ body {
 }
 #volume {
 	font-size: 1.1rem;
-	width: 1.3rem;
+	width: 4.2rem;
 	text-align: center;
 }
 .player {
@@ -82,6 +82,13 @@ body {
 	padding: 0.5rem;
 	display: inline;
 }
+.player #progress {
+	display: block;
+	width: 100%;
+	height: 0.6rem;
+	margin: 0.5rem 0 0 0;
+	cursor: pointer;
+}
 .browser {
 	padding: 1rem;
 }
@@ -183,15 +190,33 @@ function call(url, filename = '') {
 	http_get(url, function(req) {dom_get('status').innerHTML = req.responseText + ' ' + filename;});
 }
 function load_state() {
-	http_get('/state', function(req) {state = JSON.parse(req.responseText); set_volume(req); set_mode(req); load_dir(state.dir); dom_get('status').innerHTML = state.status + ' ' + state.file;});
+	http_get('/state', function(req) {state = JSON.parse(req.responseText); show_state(state); load_dir(state.dir); connect_events();});
+}
+function show_state(changes) {
+	if ('volume' in changes) dom_get('volume').value = changes.volume + ' dB';
+	if ('mode' in changes) show_mode(changes.mode);
+	if (('status' in changes) || ('file' in changes)) dom_get('status').innerHTML = state.status + ' ' + state.file;
+	dom_get('progress').max = Math.max(state.length, 1);
+	dom_get('progress').value = state.position;
+}
+function connect_events() {
+	var ws = new WebSocket('ws://' + location.host + '/events');
+	ws.onmessage = function(e) {var changes = JSON.parse(e.data); Object.assign(state, changes); show_state(changes);};
+	ws.onclose = function() {setTimeout(connect_events, 2000);};
+}
+function seek(e) {
+	if (state && state.length) http_get('/seek?t=' + (e.offsetX / e.target.clientWidth * state.length / state.rate).toFixed(3));
 }
 function set_volume(req) {
 	console.log("set_volume", JSON.parse(req.responseText).volume);
-	dom_get('volume').value = JSON.parse(req.responseText).volume;
+	dom_get('volume').value = JSON.parse(req.responseText).volume + ' dB';
 }
 var mode = 'once';
 function set_mode(req) {
-	mode = JSON.parse(req.responseText).mode;
+	show_mode(JSON.parse(req.responseText).mode);
+}
+function show_mode(value) {
+	mode = value;
 	console.log("set_mode", mode);
 	var s;
 	switch (mode) {
@@ -235,6 +260,7 @@ window.onload = function() {load_state();};
 			<div class="status">
 				<span id="status">...</span>
 			</div>
+			<progress id="progress" max="1" value="0" onclick="seek(event);"></progress>
 		</div>
 		<div class="browser">
 			<div class="path">
@@ -0,0 +1,171 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_DIR_INDEX
+#define PCM56_PLAYER_DIR_INDEX
+
+#include <dirent.h>
+#include <cstring>
+#include <strings.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <basics/error.hh>
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player directory index
+*
+* @brief Sorted index of the playable files of a directory, for the album play mode.
+*/
+
+
+// the file types the player decodes, by extension
+inline bool is_playable(std::string_view name)
+{
+	auto pos = name.rfind('.');
+	if (pos == std::string_view::npos)
+		return false;
+
+	auto extension = name.substr(pos + 1);
+
+	return ((extension.size() == 4) && (strncasecmp(extension.data(), "flac", 4) == 0))
+			|| ((extension.size() == 3) && (strncasecmp(extension.data(), "wav", 3) == 0));
+}
+
+
+/**
+* @brief The playable files of one directory, sorted by name.
+*
+* The names are packed, NUL terminated, into a single buffer and sorted through an array of
+* offsets into it: two allocations for the whole directory. The index is built on the first lookup
+* in a directory and reused until another directory is looked up or it is invalidated, on each card
+* mount. FAT leaves the directory modification time as it was when files are added, so that is no
+* sign of change; a lookup from a name missing in the index rebuilds it instead. Lookups are binary
+* searches. Not thread safe: the decoder task is its only user.
+*/
+class dir_index {
+public:
+	using offset_type = uint32_t;
+
+	dir_index()
+		: _path{}, _valid{false}, _names{}, _offsets{}
+	{}
+	dir_index(const dir_index&) = delete;
+	dir_index(dir_index&& other) = delete;
+
+	dir_index& operator=(const dir_index&) = delete;
+	dir_index& operator=(dir_index&& other) = delete;
+
+	void invalidate()
+	{
+		_valid = false;
+		_path.clear();
+		_names.clear();
+		_names.shrink_to_fit();
+		_offsets.clear();
+		_offsets.shrink_to_fit();
+	}
+
+	/**
+	* @brief The playable file after name in the directory at path; none after the last one.
+	*/
+	std::optional<std::string_view> next(const std::string &path, std::string_view name)
+	{
+		_update(path, name);
+
+		auto it = std::upper_bound(_offsets.begin(), _offsets.end(), name,
+									[this] (std::string_view value, offset_type offset) { return value < _name(offset); });
+		if (it == _offsets.end())
+			return std::nullopt;
+
+		return _name(*it);
+	}
+
+	size_t size() const
+	{
+		return _offsets.size();
+	}
+
+private:
+	std::string _path;
+	bool _valid;
+	std::vector<char> _names;
+	std::vector<offset_type> _offsets;
+
+	inline std::string_view _name(offset_type offset) const
+	{
+		return std::string_view{&_names[offset]};
+	}
+
+	// rebuilds the index unless it is the directory's and holds name
+	void _update(const std::string &path, std::string_view name)
+	{
+		if (_valid && (_path == path) && std::binary_search(_offsets.begin(), _offsets.end(), name,
+				[this] (auto a, auto b) { return _value(a) < _value(b); }))
+			return;
+
+		invalidate();
+		_build(path);
+		_path = path;
+		_valid = true;
+	}
+
+	inline std::string_view _value(offset_type offset) const
+	{
+		return _name(offset);
+	}
+
+	static inline std::string_view _value(std::string_view name)
+	{
+		return name;
+	}
+
+	void _build(const std::string &path)
+	{
+		DIR *dp = ::opendir(path.c_str());
+		if (dp == nullptr)
+			throw basics::error{"dir_index: failed opening dir '%s'", path.c_str()};
+
+		struct dirent *ep = nullptr;
+		for (;;) {
+			ep = ::readdir(dp);
+			if (ep == nullptr)
+				break;
+
+			if ((ep->d_type == DT_DIR) || !is_playable(ep->d_name))
+				continue;
+
+			_offsets.push_back((offset_type)_names.size());
+			_names.insert(_names.end(), ep->d_name, ep->d_name + strlen(ep->d_name) + 1);
+		}
+		::closedir(dp);
+
+		std::sort(_offsets.begin(), _offsets.end(),
+					[this] (offset_type a, offset_type b) { return _name(a) < _name(b); });
+		_names.shrink_to_fit();
+		_offsets.shrink_to_fit();
+	}
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_DIR_INDEX
@@ -0,0 +1,437 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_FLAC_SEEK
+#define PCM56_PLAYER_FLAC_SEEK
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <basics/error.hh>
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player FLAC seek
+*
+* @brief Locates the frame holding a given sample of a FLAC file, without decoding.
+*/
+
+
+/**
+* @brief Where decoding resumes: the frame holding the target sample, and the samples ahead of the
+*        target in it.
+*/
+struct flac_seek_point {
+	long offset;      // of the frame header, in the file
+	uint64_t sample;  // the first sample of the frame
+	uint32_t skip;    // samples to drop from the decoded frame
+};
+
+
+/**
+* @brief Finds frames in a FLAC file, through its SEEKTABLE when it has one, and by bisection over
+*        the frame headers within the bounds it gives, or else within the whole file.
+*
+* A bisection step reads a chunk at the middle of the range and takes the first frame header in it,
+* recognised by its sync code, its CRC-8 and fields matching STREAMINFO; the header codes the
+* frame's first sample (or, for fixed block size streams, the frame number). Steps aim at the frame
+* by the bit rate of the range, and halve it when the aim was off; they go on down to a few chunks
+* worth of range, read through from there: a seek takes a handful of reads. head() is the stream
+* head to feed the decoder ahead of the frame: the marker and STREAMINFO, flagged as the last
+* metadata block.
+*/
+class flac_seeker {
+public:
+	static constexpr const size_t head_size = 4 + 4 + 34;
+
+	explicit flac_seeker(const char *path)
+		: _file{::fopen(path, "rb")}, _buffer(_chunk_size), _buffer_pos{-1}, _buffer_size{0}, _read_count{0},
+		  _file_size{0}, _audio_offset{0}, _seektable_offset{0}, _seektable_count{0}, _head{}, _sample_rate{0},
+		  _channel_count{0}, _sample_bit_size{0}, _max_block_size{0}, _sample_count{0}, _variable_block_size{}
+	{
+		if (_file == nullptr)
+			throw basics::error{"flac_seek: failed opening '%s'", path};
+		setvbuf(_file, nullptr, _IONBF, 0);
+
+		try {
+			_read_metadata();
+		} catch (...) {
+			::fclose(_file);
+			throw;
+		}
+	}
+	flac_seeker(const flac_seeker&) = delete;
+	flac_seeker(flac_seeker&& other) = delete;
+
+	flac_seeker& operator=(const flac_seeker&) = delete;
+	flac_seeker& operator=(flac_seeker&& other) = delete;
+
+	~flac_seeker()
+	{
+		::fclose(_file);
+	}
+
+	std::string_view head() const
+	{
+		return {_head, head_size};
+	}
+
+	uint32_t sample_rate() const
+	{
+		return _sample_rate;
+	}
+
+	// 0 when unknown
+	uint64_t sample_count() const
+	{
+		return _sample_count;
+	}
+
+	// file reads so far
+	uint32_t read_count() const
+	{
+		return _read_count;
+	}
+
+	/**
+	* @brief The frame holding the sample; the last frame for samples past the end.
+	*/
+	flac_seek_point find(uint64_t sample)
+	{
+		if ((_sample_count != 0) && (sample >= _sample_count))
+			sample = _sample_count - 1;
+
+		auto first = _next_frame(_audio_offset, _file_size);
+		if (!first || (first->offset != _audio_offset))
+			throw basics::error{"flac_seek: no frame at the audio start"};
+
+		// the seek points bound the range, when they hold
+		auto lo = *first;
+		auto hi = _file_size;
+		auto hi_sample = std::max(_sample_count, sample + 1);
+		auto bounds = _seektable_bounds(sample);
+		if (bounds.lo > _audio_offset) {
+			auto frame = _next_frame(bounds.lo, _file_size);
+			if (frame && (frame->offset == bounds.lo) && (frame->sample <= sample))
+				lo = *frame;
+		}
+		if ((bounds.hi > lo.offset) && (bounds.hi < hi)) {
+			hi = bounds.hi;
+			hi_sample = bounds.hi_sample;
+		}
+
+		// steps aim, by the bit rate of the range, at the frame ahead of the one holding the sample,
+		// and fall back to halving the range when that did poorly
+		auto interpolate = true;
+		while ((hi - lo.offset > (long)_walk_size) && (sample >= lo.sample + lo.block_size)) {
+			auto range = hi - lo.offset;
+			auto mid = lo.offset + range / 2;
+			if (interpolate && (hi_sample > lo.sample)) {
+				auto target = std::max(sample, lo.sample + _max_block_size) - _max_block_size;
+				auto guess = lo.offset + (long)((double)range * (target - lo.sample) / (hi_sample - lo.sample));
+				mid = std::clamp(guess, lo.offset + 1, hi - 1);
+			}
+
+			auto frame = _next_frame(mid, hi);
+			if (frame && (frame->sample <= sample)) {
+				lo = *frame;
+			} else if (frame) {
+				hi = frame->offset;  // none starts in between
+				hi_sample = frame->sample;
+			} else {
+				hi = mid;
+			}
+			interpolate = (hi - lo.offset <= range / 2);
+		}
+
+		auto frame = lo;
+		while (sample >= frame.sample + frame.block_size) {
+			auto next = _next_frame(frame.offset + 1, _file_size);
+			if (!next || (next->sample > sample))
+				break;
+			frame = *next;
+		}
+
+		return {frame.offset, frame.sample, (uint32_t)std::min<uint64_t>(sample - frame.sample, frame.block_size)};
+	}
+
+private:
+	static constexpr const size_t _chunk_size = 4096;
+	static constexpr const size_t _walk_size = 4 * _chunk_size;  // cheaper to read through than to halve
+	static constexpr const size_t _header_max_size = 16;
+	static constexpr const size_t _seekpoint_size = 18;
+	static constexpr const uint64_t _placeholder = UINT64_MAX;
+
+	struct frame_type {
+		long offset;
+		uint64_t sample;
+		uint32_t block_size;
+	};
+
+	// file offsets, 0 for none
+	struct bounds_type {
+		long lo;
+		long hi;
+		uint64_t hi_sample;
+	};
+
+	FILE *_file;
+	std::vector<uint8_t> _buffer;
+	long _buffer_pos;  // file offset of the buffer content
+	size_t _buffer_size;
+	uint32_t _read_count;
+	long _file_size;
+	long _audio_offset;
+	long _seektable_offset;
+	uint32_t _seektable_count;
+	char _head[head_size];
+	uint32_t _sample_rate;
+	uint8_t _channel_count;
+	uint8_t _sample_bit_size;
+	uint16_t _max_block_size;
+	uint64_t _sample_count;
+	std::optional<bool> _variable_block_size;  // the stream's blocking strategy, from its first frame
+
+	static uint32_t _be(const uint8_t *data, size_t size)
+	{
+		auto value = uint32_t{0};
+		for (size_t i = 0; i < size; ++i)
+			value = value << 8 | data[i];
+
+		return value;
+	}
+
+	static uint8_t _crc8(const uint8_t *data, size_t size)
+	{
+		auto crc = uint8_t{0};
+		for (size_t i = 0; i < size; ++i) {
+			crc ^= data[i];
+			for (size_t bit = 0; bit < 8; ++bit)
+				crc = (crc & 0x80)? (crc << 1) ^ 0x07 : crc << 1;
+		}
+
+		return crc;
+	}
+
+	// the file content from pos on, at least min_size bytes of it unless the file ends sooner
+	const uint8_t *_read(long pos, size_t min_size, size_t &size)
+	{
+		if ((pos < _buffer_pos) || (pos + (long)min_size > _buffer_pos + (long)_buffer_size)) {
+			_buffer_pos = pos;
+			_buffer_size = 0;
+			if (::fseek(_file, pos, SEEK_SET) == 0)
+				_buffer_size = ::fread(_buffer.data(), 1, _chunk_size, _file);
+			++_read_count;
+		}
+
+		size = _buffer_size - (pos - _buffer_pos);
+
+		return &_buffer[pos - _buffer_pos];
+	}
+
+	void _read_metadata()
+	{
+		::fseek(_file, 0, SEEK_END);
+		_file_size = ::ftell(_file);
+
+		size_t size = 0;
+		auto *data = _read(0, 4 + 4 + 34, size);
+		if ((size < 4 + 4 + 34) || (memcmp(data, "fLaC", 4) != 0) || ((data[4] & 0x7f) != 0))
+			throw basics::error{"flac_seek: no FLAC stream"};
+
+		memcpy(_head, data, head_size);
+		_head[4] = (char)0x80;  // STREAMINFO, last block
+		_head[5] = 0;
+		_head[6] = 0;
+		_head[7] = 34;
+
+		// 16 bit min/max block size, 24 bit min/max frame size, then 20 bit rate, 3 bit channels - 1,
+		// 5 bit sample size - 1, 36 bit sample count
+		auto *info = data + 8;
+		_max_block_size = (uint16_t)_be(info + 2, 2);
+		_sample_rate = info[10] << 12 | info[11] << 4 | info[12] >> 4;
+		_channel_count = ((info[12] >> 1) & 0x07) + 1;
+		_sample_bit_size = ((info[12] & 0x01) << 4 | info[13] >> 4) + 1;
+		_sample_count = (uint64_t)(info[13] & 0x0f) << 32 | _be(info + 14, 4);
+		if (_sample_rate == 0)
+			throw basics::error{"flac_seek: bad STREAMINFO"};
+
+		// the block headers, up to the first frame
+		static constexpr const uint8_t seektable_type = 3;
+		auto pos = long{4};
+		for (auto last = false; !last; ) {
+			data = _read(pos, 4, size);
+			if (size < 4)
+				throw basics::error{"flac_seek: truncated metadata"};
+
+			auto header = _be(data, 4);
+			last = (header & 0x80000000);
+			auto block_size = (long)(header & 0x00ffffff);
+			if (((header >> 24) & 0x7f) == seektable_type) {
+				_seektable_offset = pos + 4;
+				_seektable_count = block_size / _seekpoint_size;
+			}
+			pos += 4 + block_size;
+		}
+		_audio_offset = pos;
+	}
+
+	// the seek points around the sample
+	bounds_type _seektable_bounds(uint64_t sample)
+	{
+		auto bounds = bounds_type{0, 0, 0};
+		for (uint32_t i = 0; i < _seektable_count; ++i) {
+			size_t size = 0;
+			auto *data = _read(_seektable_offset + i * _seekpoint_size, _seekpoint_size, size);
+			if (size < _seekpoint_size)
+				break;
+
+			auto point_sample = (uint64_t)_be(data, 4) << 32 | _be(data + 4, 4);
+			auto point_offset = (uint64_t)_be(data + 8, 4) << 32 | _be(data + 12, 4);
+			if (point_sample == _placeholder)
+				break;  // placeholders come last
+			if (point_offset > (uint64_t)(_file_size - _audio_offset))
+				break;
+
+			if (point_sample > sample) {
+				bounds.hi = _audio_offset + (long)point_offset;
+				bounds.hi_sample = point_sample;
+
+				break;
+			}
+			bounds.lo = _audio_offset + (long)point_offset;
+		}
+
+		return bounds;
+	}
+
+	// the frame whose header starts at data, if it is one of this stream
+	std::optional<frame_type> _parse_header(const uint8_t *data, size_t size)
+	{
+		static const uint32_t sample_rates[] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+												32000, 44100, 48000, 96000};
+		static const uint8_t sample_bit_sizes[] = {0, 8, 12, 0, 16, 20, 24, 32};
+
+		if ((size < 6) || (data[0] != 0xff) || ((data[1] & 0xfe) != 0xf8))
+			return std::nullopt;
+
+		auto variable = (bool)(data[1] & 0x01);
+		auto block_code = data[2] >> 4;
+		auto rate_code = data[2] & 0x0f;
+		auto channel_code = data[3] >> 4;
+		auto bit_code = (data[3] >> 1) & 0x07;
+		if (_variable_block_size && (variable != *_variable_block_size))
+			return std::nullopt;
+		if ((block_code == 0) || (rate_code == 15) || (channel_code > 10) || (bit_code == 3) || (data[3] & 0x01))
+			return std::nullopt;
+		if (((channel_code < 8)? channel_code + 1 : 2) != _channel_count)
+			return std::nullopt;
+		if ((bit_code != 0) && (sample_bit_sizes[bit_code] != _sample_bit_size))
+			return std::nullopt;
+		if ((rate_code != 0) && (rate_code < 12) && (sample_rates[rate_code] != _sample_rate))
+			return std::nullopt;
+
+		// the UTF-8 like coded frame or sample number
+		auto pos = size_t{4};
+		auto length = (data[pos] < 0x80)? 1 : __builtin_clz(~((uint32_t)data[pos] << 24));
+		if ((length == 1) && (data[pos] >= 0x80))
+			return std::nullopt;
+		if ((length > 7) || (pos + length + 4 > size))
+			return std::nullopt;
+		auto number = (uint64_t)(data[pos] & ((length == 1)? 0x7f : 0x7f >> length));
+		for (int i = 1; i < length; ++i) {
+			if ((data[pos + i] & 0xc0) != 0x80)
+				return std::nullopt;
+			number = number << 6 | (data[pos + i] & 0x3f);
+		}
+		pos += length;
+
+		auto block_size = uint32_t{0};
+		if (block_code == 1)
+			block_size = 192;
+		else if (block_code <= 5)
+			block_size = 576u << (block_code - 2);
+		else if (block_code == 6)
+			block_size = data[pos++] + 1;
+		else if (block_code == 7)
+			block_size = _be(&data[(pos += 2) - 2], 2) + 1;
+		else
+			block_size = 256u << (block_code - 8);
+
+		if (rate_code == 12) {
+			if (data[pos++] * 1000u != _sample_rate)
+				return std::nullopt;
+		} else if (rate_code == 13) {
+			if (_be(&data[(pos += 2) - 2], 2) != _sample_rate)
+				return std::nullopt;
+		} else if (rate_code == 14) {
+			if (_be(&data[(pos += 2) - 2], 2) * 10 != _sample_rate)
+				return std::nullopt;
+		}
+
+		if ((pos >= size) || (_crc8(data, pos) != data[pos]))
+			return std::nullopt;
+
+		_variable_block_size = variable;
+		return frame_type{0, variable? number : number * _max_block_size, block_size};
+	}
+
+	// the first frame starting in [pos, end)
+	std::optional<frame_type> _next_frame(long pos, long end)
+	{
+		while (pos < end) {
+			size_t size = 0;
+			auto *data = _read(pos, _header_max_size, size);
+			if (size == 0)
+				return std::nullopt;
+
+			auto count = std::min<long>(end - pos, size);
+			for (long i = 0; i < count; ++i) {
+				if (data[i] != 0xff)
+					continue;
+
+				// the header may run over the chunk end
+				if (size - i < _header_max_size) {
+					data = _read(pos + i, _header_max_size, size);
+					count = std::min<long>(end - pos - i, size);
+					pos += i;
+					i = 0;
+				}
+
+				auto frame = _parse_header(&data[i], size - i);
+				if (frame) {
+					frame->offset = pos + i;
+
+					return frame;
+				}
+			}
+			pos += count;
+		}
+
+		return std::nullopt;
+	}
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_FLAC_SEEK
@@ -0,0 +1,109 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_STREAMINFO_CACHE
+#define PCM56_PLAYER_STREAMINFO_CACHE
+
+#include <mutex>
+#include <string>
+#include <optional>
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player streaminfo cache
+*
+* @brief Parsed stream parameters of the recently played or checked tracks.
+*/
+
+
+/**
+* @brief Least recently used cache of CAPACITY INFO entries, by track path.
+*
+* Lookups are linear over the few entries. Shared by the httpd and the decoder tasks, hence locked.
+*/
+template<typename INFO, size_t CAPACITY>
+class streaminfo_cache {
+public:
+	streaminfo_cache()
+		: _entries{}, _clock{0}, _lock{}
+	{}
+	streaminfo_cache(const streaminfo_cache&) = delete;
+	streaminfo_cache(streaminfo_cache&& other) = delete;
+
+	streaminfo_cache& operator=(const streaminfo_cache&) = delete;
+	streaminfo_cache& operator=(streaminfo_cache&& other) = delete;
+
+	std::optional<INFO> find(const std::string &path)
+	{
+		std::lock_guard<std::mutex> guard{_lock};
+		for (auto &entry : _entries) {
+			if ((entry.last_use != 0) && (entry.path == path)) {
+				entry.last_use = ++_clock;
+
+				return entry.info;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	// replaces the entry of the path, or else the least recently used one
+	void insert(const std::string &path, const INFO &info)
+	{
+		std::lock_guard<std::mutex> guard{_lock};
+		auto *slot = &_entries[0];
+		for (auto &entry : _entries) {
+			if ((entry.last_use != 0) && (entry.path == path)) {
+				slot = &entry;
+
+				break;
+			}
+			if (entry.last_use < slot->last_use)
+				slot = &entry;
+		}
+
+		slot->path = path;
+		slot->info = info;
+		slot->last_use = ++_clock;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> guard{_lock};
+		for (auto &entry : _entries) {
+			entry.path.clear();
+			entry.last_use = 0;
+		}
+	}
+
+private:
+	struct entry_type {
+		std::string path;
+		INFO info;
+		uint32_t last_use;  // 0 for a free entry
+	};
+
+	entry_type _entries[CAPACITY];
+	uint32_t _clock;
+	std::mutex _lock;
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_STREAMINFO_CACHE
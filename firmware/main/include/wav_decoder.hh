@@ -0,0 +1,296 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_WAV_DECODER
+#define PCM56_PLAYER_WAV_DECODER
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <istream>
+#include <algorithm>
+#include <basics/error.hh>
+#include <wav_tags.hh>
+#include <sample_convert.hh>
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player WAVE decoder
+*
+* @brief PCM WAVE input, passed straight to the player buffer, or in decoded blocks alike the FLAC
+*        decoder's, for the resampler.
+*/
+
+
+// a canonical header (RIFF, 16 byte PCM fmt, data) ahead of the data
+static constexpr const size_t wav_head_size = 44;
+
+
+/**
+* @brief Writes the canonical header of a stream of the format holding sample_count frames, an
+*        unknown count for 0.
+*/
+inline void make_wav_head(const library::wav_format &format, uint64_t sample_count, char (&head)[wav_head_size])
+{
+	auto data_size = (sample_count == 0)?
+		UINT32_MAX : (uint32_t)std::min<uint64_t>(sample_count * format.block_align, UINT32_MAX - wav_head_size);
+	auto put = [&head] (size_t pos, uint32_t value, size_t size) {
+		for (size_t i = 0; i < size; ++i)
+			head[pos + i] = (char)(value >> (8 * i));
+	};
+
+	memcpy(head, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0", 20);
+	put(4, data_size + wav_head_size - 8, 4);
+	put(20, library::detail::wave_format_pcm, 2);
+	put(22, format.channel_count, 2);
+	put(24, format.sample_rate, 4);
+	put(28, format.sample_rate * format.block_align, 4);
+	put(32, format.block_align, 2);
+	put(34, format.container_size * 8, 2);
+	memcpy(head + 36, "data", 4);
+	put(40, data_size, 4);
+}
+
+
+/**
+* @brief Reads the frames of a PCM WAVE stream: straight into the player buffer, or BLOCK_SIZE at a
+*        time into planar SAMPLE blocks.
+*
+* There is nothing to decode. pass() reads the data bytes into the player buffer slots themselves,
+* for frames no larger than an encoded sample (16 bit stereo, or mono), and converts them there in
+* place, in one pass; larger frames go through a small chunk. A block, for the resampler, is the
+* data bytes spread over the channels as they are sign extended. Samples narrower than their
+* container are left justified in it, as per the format: they pass through as container sized, and
+* come out of blocks right justified.
+*/
+template<typename INPUT, typename SAMPLE, size_t BLOCK_SIZE>
+class wav_decoder {
+public:
+	explicit wav_decoder(INPUT &input)
+		: _input{input}, _format{}, _remaining{0}, _block_size{0},
+		  _samples{std::make_unique<SAMPLE[]>(2 * BLOCK_SIZE)}, _channels{&_samples[0], &_samples[BLOCK_SIZE]}
+	{}
+	wav_decoder(const wav_decoder&) = delete;
+	wav_decoder(wav_decoder&& other) = delete;
+
+	wav_decoder& operator=(const wav_decoder&) = delete;
+	wav_decoder& operator=(wav_decoder&& other) = delete;
+
+	~wav_decoder() = default;
+
+	void decode_metadata()
+	{
+		if (!library::read_wav_header(_input, _format))
+			throw basics::error{"wav_decoder: no PCM WAVE stream"};
+		if (_format.channel_count > 2)
+			throw basics::error{"wav_decoder: %u channels", _format.channel_count};
+
+		_remaining = (_format.data_size == UINT32_MAX)? UINT64_MAX : _format.data_size / _format.block_align;
+		if (_format.channel_count == 1)
+			_channels[1] = _channels[0];
+	}
+
+	const library::wav_format &format() const
+	{
+		return _format;
+	}
+
+	/**
+	* @brief Reads up to count frames into out, as encoded player samples with the ramped gain;
+	*        returns the frames read, short of count at the end of the data only.
+	*/
+	size_t pass(encoded_sample_type *out, size_t count, gain_ramp &ramp)
+	{
+		if (_format.block_align <= sizeof(encoded_sample_type)) {
+			// the frames take no more room than their encoded samples: read them where these go
+			count = _read((uint8_t *)out, count);
+			_pass_kernel(_format, (const uint8_t *)out, out, count, ramp);
+
+			return count;
+		}
+
+		auto done = size_t{0};
+		uint8_t data[_chunk_size];
+		while (done < count) {
+			auto frames = _read(data, std::min(count - done, _chunk_size / _format.block_align));
+			if (frames == 0)
+				break;
+
+			_pass_kernel(_format, data, out + done, frames, ramp);
+			done += frames;
+		}
+
+		return done;
+	}
+
+	void skip(uint64_t frames)
+	{
+		frames = std::min(frames, _remaining);
+		_input.ignore(frames * _format.block_align);
+		_remaining -= frames;
+	}
+
+	void decode_audio()
+	{
+		_block_size = 0;
+		uint8_t data[_chunk_size];
+		while (_block_size < BLOCK_SIZE) {
+			auto frames = _read(data, std::min(BLOCK_SIZE - _block_size, _chunk_size / _format.block_align));
+			if (frames == 0)
+				break;
+
+			_spread(data, frames);
+			_block_size += frames;
+		}
+	}
+
+	size_t block_size() const
+	{
+		return _block_size;
+	}
+
+	const SAMPLE *const (&block_data() const)[2]
+	{
+		return _channels;
+	}
+
+	bool complete() const
+	{
+		return _remaining == 0;
+	}
+
+private:
+	static constexpr const size_t _chunk_size = 512;
+
+	INPUT &_input;
+	library::wav_format _format;
+	uint64_t _remaining;  // frames
+	size_t _block_size;
+	std::unique_ptr<SAMPLE[]> _samples;
+	const SAMPLE *_channels[2];
+
+	// reads up to count whole frames into data; returns the frames read
+	size_t _read(uint8_t *data, size_t count)
+	{
+		count = (size_t)std::min<uint64_t>(count, _remaining);
+		if (count == 0)
+			return 0;
+
+		_input.read((char *)data, count * _format.block_align);
+		count = _input.gcount() / _format.block_align;
+		_remaining = (count == 0)? 0 : _remaining - count;  // or the file ends short of its data size
+
+		return count;
+	}
+
+	static void _pass_kernel(const library::wav_format &format, const uint8_t *data, encoded_sample_type *out,
+								size_t count, gain_ramp &ramp)
+	{
+		if (ramp.kind == gain_kind::unity)
+			_pass_kernel<gain_kind::unity>(format, data, out, count, ramp);
+		else if (ramp.kind == gain_kind::cut)
+			_pass_kernel<gain_kind::cut>(format, data, out, count, ramp);
+		else
+			_pass_kernel<gain_kind::boost>(format, data, out, count, ramp);
+		ramp.advance(count);
+	}
+
+	template<gain_kind GAIN>
+	static void _pass_kernel(const library::wav_format &format, const uint8_t *data, encoded_sample_type *out,
+								size_t count, const gain_ramp &ramp)
+	{
+		auto stereo = (format.channel_count == 2);
+		if (format.container_size == 2)
+			stereo? _pass<2, 2, GAIN>(data, out, count, ramp) : _pass<2, 1, GAIN>(data, out, count, ramp);
+		else if (format.container_size == 3)
+			stereo? _pass<3, 2, GAIN>(data, out, count, ramp) : _pass<3, 1, GAIN>(data, out, count, ramp);
+		else
+			stereo? _pass<4, 2, GAIN>(data, out, count, ramp) : _pass<4, 1, GAIN>(data, out, count, ramp);
+	}
+
+	/**
+	* @brief The frames at data to encoded samples at out, last to first: out may be data itself, the
+	*        frames being no larger than the samples, each one read before its sample is written.
+	*        The ramp is a copy, that the words written cannot alias.
+	*/
+	template<size_t SIZE, uint8_t CHANNEL_COUNT, gain_kind GAIN>
+	static void _pass(const uint8_t *data, encoded_sample_type *out, size_t count, gain_ramp ramp)
+	{
+		using converter = block_converter<int32_t, 8 * SIZE, CHANNEL_COUNT, GAIN>;
+
+		for (size_t i = count; i-- > 0; ) {
+			const uint8_t *frame = data + i * SIZE * CHANNEL_COUNT;
+			auto gain = ramp.at(i);
+			auto ch0 = converter::scale(converter::normalise(_sample<SIZE>(frame), 8 * SIZE), gain);
+			auto ch1 = (CHANNEL_COUNT == 2)?
+				converter::scale(converter::normalise(_sample<SIZE>(frame + SIZE), 8 * SIZE), gain) : ch0;
+			out[i] = pcm56_encoding::encode(ch0, ch1);
+		}
+	}
+
+	void _spread(const uint8_t *data, size_t frames)
+	{
+		auto *ch0 = const_cast<SAMPLE *>(_channels[0]) + _block_size;
+		auto *ch1 = const_cast<SAMPLE *>(_channels[1]) + _block_size;
+		auto stereo = (_format.channel_count == 2);
+		if (_format.container_size == 2) {
+			for (size_t i = 0; i < frames; ++i, data += _format.block_align) {
+				ch0[i] = _sample<2>(data);
+				if (stereo)
+					ch1[i] = _sample<2>(data + 2);
+			}
+		} else if (_format.container_size == 3) {
+			for (size_t i = 0; i < frames; ++i, data += _format.block_align) {
+				ch0[i] = _sample<3>(data);
+				if (stereo)
+					ch1[i] = _sample<3>(data + 3);
+			}
+		} else {
+			for (size_t i = 0; i < frames; ++i, data += _format.block_align) {
+				ch0[i] = _sample<4>(data);
+				if (stereo)
+					ch1[i] = _sample<4>(data + 4);
+			}
+		}
+
+		// left justified valid bits
+		auto shift = _format.container_size * 8 - _format.sample_bit_size;
+		if (shift != 0) {
+			for (size_t i = 0; i < frames; ++i) {
+				ch0[i] >>= shift;
+				if (stereo)
+					ch1[i] >>= shift;
+			}
+		}
+	}
+
+	template<size_t SIZE>
+	static inline int32_t _sample(const uint8_t *data)
+	{
+		auto value = uint32_t{0};
+		for (size_t i = 0; i < SIZE; ++i)
+			value |= (uint32_t)data[i] << (8 * i);
+
+		return (int32_t)(value << (32 - 8 * SIZE)) >> (32 - 8 * SIZE);
+	}
+};
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_WAV_DECODER
@@ -0,0 +1,110 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCM56_PLAYER_WS_BROADCAST
+#define PCM56_PLAYER_WS_BROADCAST
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include "esp_http_server.h"
+
+
+namespace pcm56_player {
+
+/**
+* @name pcm56 player WebSocket broadcast
+*
+* @brief Text messages pushed to all the WebSocket clients of the HTTP server.
+*/
+
+
+// no fewer than the server's max_open_sockets
+static constexpr const size_t ws_client_max = 8;
+
+
+// the open WebSocket connections
+inline size_t ws_client_count(httpd_handle_t server)
+{
+	int fds[ws_client_max];
+	size_t count = ws_client_max;
+	if (httpd_get_client_list(server, &count, fds) != ESP_OK)
+		return 0;
+
+	size_t res = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (httpd_ws_get_fd_info(server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET)
+			++res;
+	}
+
+	return res;
+}
+
+
+namespace detail {
+
+struct ws_broadcast_work {
+	httpd_handle_t server;
+	std::string text;  // the work item's own copy, the sender's may be gone by the time it runs
+};
+
+
+// runs on the server task, the one the server's sockets may be written from
+inline void ws_broadcast_send(void *arg)
+{
+	std::unique_ptr<ws_broadcast_work> work{(ws_broadcast_work *)arg};
+
+	int fds[ws_client_max];
+	size_t count = ws_client_max;
+	if (httpd_get_client_list(work->server, &count, fds) != ESP_OK)
+		return;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (httpd_ws_get_fd_info(work->server, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET)
+			continue;
+
+		httpd_ws_frame_t frame{};
+		frame.final = true;
+		frame.type = HTTPD_WS_TYPE_TEXT;
+		frame.payload = (uint8_t *)work->text.data();
+		frame.len = work->text.size();
+		httpd_ws_send_frame_async(work->server, fds[i], &frame);
+	}
+}
+
+};  // namespace detail
+
+
+/**
+* @brief Sends the text to the WebSocket clients, from any task; false when it could not be queued.
+*
+* The sends are queued as work to the server task, with a copy of the text. A client that fails
+* the send is left to the server, which closes its socket.
+*/
+inline bool ws_broadcast(httpd_handle_t server, std::string_view text)
+{
+	auto work = std::unique_ptr<detail::ws_broadcast_work>{new detail::ws_broadcast_work{server, std::string{text}}};
+	if (httpd_queue_work(server, &detail::ws_broadcast_send, work.get()) != ESP_OK)
+		return false;
+	work.release();  // the work function's now
+
+	return true;
+}
+
+
+};  // namespace pcm56_player
+
+#endif // PCM56_PLAYER_WS_BROADCAST
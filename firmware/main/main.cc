@@ -18,15 +18,32 @@
 #include <dirent.h>
 #include <iostream>
 #include <sstream>
+#include <array>
 #include <cstring>
+#include <cinttypes>
 #include <algorithm>
+#include <exception>
+#include <optional>
+#include <mutex>
+#include <type_traits>
 #include "esp_http_server.h"
 #include "sdmmc_cmd.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "nvs.h"
 
 #include <basics/file.hh>
 #include <basics/base64.hh>
 #include <audio/flac.hh>
 #include <defs.hh>
+#include <dir_index.hh>
+#include <chunked_response.hh>
+#include <streaminfo_cache.hh>
+#include <flac_seek.hh>
+#include <wav_decoder.hh>
+#include <ws_broadcast.hh>
+#include <command_queue.hh>
 #include <gpio.hh>
 #include <nvs_partition.hh>
 #include <wifi.hh>
@@ -34,6 +51,13 @@
 #include <spi_sd.hh>
 #include <stream_buffer.hh>
 #include <player.hh>
+#include <dma_player.hh>
+#include <dac_gpio_reference.hh>
+#include <sample_convert.hh>
+#include <resampler.hh>
+#include <read_ahead.hh>
+#include <net_stream.hh>
+#include <library_scanner.hh>
 
 
 //      SPI       GPIO    SD     SDSPI  MMC
@@ -49,27 +73,87 @@
 #define PCM_CH1_DATA  26
 #define PCM_CH2_DATA  25
 
+// DMA output only: spare i80 bus lines, not routed on the reference board
+#define PCM_DMA_D4    32
+#define PCM_DMA_D5    33
+#define PCM_DMA_D6    16
+#define PCM_DMA_D7    17
+#define PCM_DMA_WR    4
+#define PCM_DMA_DC    5
+
 #define SRC_RLY  12
 #define PWR_RLY  13
 
 static const unsigned char wifi_ssid[32] = "WIFI_AP";
 static const unsigned char wifi_pasw[64] = "WIFI_PASS";
 
-static const double frequency_calibration = 0.995428; //ideally: 1, adjusted by trial-and-error;
-static const uint16_t buffer_max_size = 4608;
-static const uint8_t buffer_max_count = 2;
-
-using player_buffer_type = stream_buffer<stereo_sample_type, buffer_max_size>;
-using pcm56_player_type = stereo_player<player_buffer_type>;
-using input_file_type = basics::file::input<1024>;
-using flac_decoder_type = audio::flac::decoder<input_file_type, buffer_max_size>;
+// sample clock trim, in ppm of the sample rate; persisted in NVS, settable over /clock. The default
+// reproduces the rate the former 0.995428 period factor, rounded to 902 ticks, played at 44.1kHz
+static const int32_t default_clock_trim_ppm = 5576;
+static const int32_t clock_trim_limit_ppm = 20000;
+static const char *settings_namespace = "player";
+static const char *clock_trim_key = "clock_trim";
+static const uint16_t block_max_size = 4608;
+static const uint16_t wav_block_size = 1152;  // frames per WAVE block, alike a typical FLAC frame
+static const uint16_t buffer_slot_size = 512;
+static const uint8_t buffer_slot_count = 8;  // 4096 samples, ~93ms @ 44.1kHz
+
+static const uint32_t decoder_task_stack_size = 6144;
+static const UBaseType_t decoder_task_priority = 10;  // above httpd and main, below lwIP and Wi-Fi
+static const BaseType_t decoder_task_core = 1;        // the player ISR, esp_timer and main are on core 0
+
+static const uint16_t read_ahead_block_size = 4096;  // 8 sectors
+static const uint8_t read_ahead_block_count = 6;     // 24kB, ~140ms of 16 bit 44.1kHz FLAC at worst
+static const uint8_t read_ahead_core = 0;            // along with the SPI bus
+static const UBaseType_t read_ahead_priority = 11;   // above the decoder
+
+static const uint16_t net_stream_block_size = 2048;
+static const uint8_t net_stream_block_count = 16;   // 32kB, ~180ms of 16 bit 44.1kHz PCM, twice as much of FLAC
+static const uint8_t net_stream_core = 0;           // off the decoder's core; lwIP is on core 1
+static const UBaseType_t net_stream_priority = 11;  // above the decoder
+
+static const size_t streaminfo_cache_size = 16;
+static const size_t command_queue_size = 8;
+
+static const uint32_t state_push_period_ms = 250;        // at most 4 updates/second, the changes batched
+static const uint32_t state_push_stack_size = 4096;
+static const UBaseType_t state_push_priority = 3;        // below httpd
+static const BaseType_t state_push_core = 0;
+
+static const size_t library_scan_max_tracks = 1000;  // ~100kB of catalogue; more through the host tool
+static const UBaseType_t library_scan_priority = 2;  // below httpd
+static const BaseType_t library_scan_core = 0;
+static const size_t library_search_limit = 50;
+
+static const bool dma_output = false;  // bit-banged GPIO @ gptimer ISR vs. I2S-LCD DMA
+static const bool isr_benchmark = false;  // DAC encoder cycle counts at start up, see benchmark_isr
+static const size_t isr_benchmark_samples = 4096;
+static const bool resampler_benchmark = false;  // resampler cycle counts at start up, see benchmark_resampler
+static const size_t resampler_benchmark_block_size = 1024;
+static const size_t resampler_benchmark_blocks = 16;
+
+using player_buffer_type = stream_buffer<encoded_sample_type, buffer_slot_size, buffer_slot_count>;
+using pcm56_player_type = std::conditional_t<dma_output,
+												stereo_dma_player<player_buffer_type>,
+												stereo_player<player_buffer_type>>;
+using read_ahead_type = read_ahead_buffer<read_ahead_block_size, read_ahead_block_count>;
+using input_file_type = read_ahead_input<read_ahead_type>;
+using net_stream_type = net_stream_buffer<net_stream_block_size, net_stream_block_count>;
+// the decoders read the std::istream base, the same code for files and network streams
+using flac_decoder_type = audio::flac::decoder<std::istream, block_max_size>;
+using flac_sample_type = std::remove_cvref_t<decltype(std::declval<flac_decoder_type>().block_data()[0][0])>;
+using wav_decoder_type = pcm56_player::wav_decoder<std::istream, flac_sample_type, wav_block_size>;
+using resampler_type = polyphase_resampler<flac_sample_type>;
 
 enum class cmd_type: uint8_t {
-	idle,
-	list,
 	play,
 	stop,
+	volume,
+	mode,
+	seek,
+	stream,
 };
+static const size_t cmd_type_count = 6;
 enum class state_type: uint8_t {
 	init,
 	has_connection,
@@ -84,13 +168,24 @@ enum class play_mode_type: uint8_t {
 };
 
 
+/**
+* @brief A request from the HTTP handlers to the player, stamped for its latency.
+*/
+struct player_command {
+	cmd_type type;
+	int32_t value;     // volume, mode, seek (ms), stream (port)
+	std::string path;  // play; stream (host)
+	int64_t time_us;   // esp_timer_get_time, when requested
+};
+
+
 auto bus_config = esp::io::spi_bus_config{
 	.sck_pin  = SD_SCK,  // SD#CLK,
 	.mosi_pin = SD_MOSI, // SD#CMD,
 	.miso_pin = SD_MISO, // SD#DAT0,
 	.quadwp_pin = -1,    // SD#DAT2,
 	.quadhd_pin = -1,    // SD#DAT3,
-	.max_transfer_size = buffer_max_size,
+	.max_transfer_size = block_max_size,
 	.core_affinity = esp::io::cpu_core_affinity::cpu_core_0,
 };
 auto sd_config = esp::io::spi_sd_config{
@@ -103,6 +198,13 @@ auto player_config = stereo_player_config {
 	.ch2_data_gpio = PCM_CH2_DATA,
 	.le_gpio       = PCM_LE,
 };
+auto dma_config = dma_player_config {
+	.pins = player_config,
+	.spare_data_gpios = {PCM_DMA_D4, PCM_DMA_D5, PCM_DMA_D6, PCM_DMA_D7},
+	.wr_gpio = PCM_DMA_WR,
+	.dc_gpio = PCM_DMA_DC,
+	.core = 0,
+};
 auto relays_config = pcm56_player::relays_output_config {
 	.source_gpio = SRC_RLY,
 	.power_gpio = PWR_RLY,
@@ -112,171 +214,810 @@ auto card_detect_config = pcm56_player::card_detect_input_config {
 };
 
 auto player_buffer = player_buffer_type{};
-auto cmd = cmd_type{};
-auto state = state_type{};
+auto playback_stats = player_stats{};
+auto sd_stats = read_ahead_stats{};
+auto net_stats = net_stream_stats{};
+auto decode_load_max = std::atomic<uint32_t>{0};  // worst block decode time, per mille of its play time
+auto clock_trim_ppm = std::atomic<int32_t>{default_clock_trim_ppm};
+auto clock_reference_us = std::atomic<int64_t>{0};       // measured rate reference, see clock_handler
+auto clock_reference_count = std::atomic<uint32_t>{0};
+auto state = std::atomic<state_type>{};  // written by the player task, read by the httpd and state ones
 auto current_dir = std::string{"/"};
-auto play_mode = play_mode_type{};
+auto play_mode = std::atomic<play_mode_type>{};  // written by the player task, read by the httpd and state ones
 auto play_dir = std::string{"/"};
 auto play_file = std::string{};
 auto play_path = std::string{};
-auto volume = int16_t{0};
+// current_dir and the play paths, written by their owner tasks, read by the state ones
+std::mutex path_lock{};
+// the position of the track, in output samples: played since consumed_count was track_start, plus
+// track_offset skipped by a seek, up to track_length; set by the decoder as it starts the track
+auto track_start = std::atomic<uint32_t>{0};
+auto track_offset = std::atomic<uint32_t>{0};
+auto track_length = std::atomic<uint32_t>{0};
+auto state_full_push = std::atomic<bool>{false};  // a new WebSocket client gets the whole state
+auto volume = std::atomic<int16_t>{0};  // 0.5dB steps
+auto requested_volume = int16_t{0};      // the last one requested; the httpd task's
+resampler_type resampler{};
+pcm56_player::dir_index album_index{};  // the decoder task's, see get_next_album_track
+pcm56_player::streaminfo_cache<audio::flac::streaminfo_type, streaminfo_cache_size> streaminfo_cache{};
+pcm56_player::mpsc_queue<player_command, command_queue_size> commands{};  // consumed by the decoder in a session, else the player
+pcm56_player::command_latency command_latencies[cmd_type_count]{};
+TaskHandle_t player_task = nullptr;
+library::scanner library_scanner{sd_config.mount_point, library_scan_max_tracks, library_scan_priority, library_scan_core};
 
 pcm56_player::relays_output relays{relays_config};
 pcm56_player::card_detect_input card_detect{card_detect_config};
 
 
-std::string get_next_album_track()
+// the players take the trim as a sample period factor
+double frequency_calibration(int32_t trim_ppm)
+{
+	return 1 / (1 + trim_ppm * 1e-6);
+}
+
+void reset_clock_reference()
+{
+	clock_reference_count.store(playback_stats.played_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	clock_reference_us.store(esp_timer_get_time(), std::memory_order_relaxed);
+}
+
+int32_t load_clock_trim()
+{
+	auto trim_ppm = default_clock_trim_ppm;
+	nvs_handle_t nvs_handle;
+	if (nvs_open(settings_namespace, NVS_READONLY, &nvs_handle) == ESP_OK) {
+		nvs_get_i32(nvs_handle, clock_trim_key, &trim_ppm);  // left as is when not found
+		nvs_close(nvs_handle);
+	}
+
+	return trim_ppm;
+}
+
+void store_clock_trim(int32_t trim_ppm)
+{
+	nvs_handle_t nvs_handle;
+	if (nvs_open(settings_namespace, NVS_READWRITE, &nvs_handle) != ESP_OK)
+		throw basics::error{"nvs: failed opening '%s'", settings_namespace};
+
+	auto err = nvs_set_i32(nvs_handle, clock_trim_key, trim_ppm);
+	if (err == ESP_OK)
+		err = nvs_commit(nvs_handle);
+	nvs_close(nvs_handle);
+	if (err != ESP_OK)
+		throw basics::error{"nvs: failed storing '%s'", clock_trim_key};
+}
+
+
+template<typename PLAYER = pcm56_player_type>
+const typename PLAYER::config_type &output_config()
+{
+	if constexpr (std::is_same_v<typename PLAYER::config_type, dma_player_config>)
+		return dma_config;
+	else
+		return player_config;
+}
+
+
+// JSON string content: quotes and backslashes escaped, control characters blanked
+std::string json_escape(std::string_view value)
+{
+	std::string res{};
+	res.reserve(value.size());
+	for (auto c : value) {
+		if ((c == '"') || (c == '\\'))
+			res += '\\';
+		if ((unsigned char)c < 0x20)
+			c = ' ';
+		res += c;
+	}
+
+	return res;
+}
+
+
+bool is_supported(const audio::flac::streaminfo_type &info)
+{
+	return (info.channel_count <= player_channel_count) && (info.sample_rate <= player_max_sample_rate);
+}
+
+
+// the WAVE format as FLAC stream parameters
+audio::flac::streaminfo_type to_streaminfo(const library::wav_format &format)
 {
-	std::string dir_path{sd_config.mount_point};
-	dir_path += play_dir;
+	audio::flac::streaminfo_type info{};
+	info.min_block_size = wav_block_size;
+	info.max_block_size = wav_block_size;
+	info.sample_rate = format.sample_rate;
+	info.channel_count = format.channel_count;
+	info.sample_bit_size = format.sample_bit_size;
+	info.sample_count = format.sample_count;
+
+	return info;
+}
+
+
+// the stream parameters of the track, from the cache if it was played or checked lately
+audio::flac::streaminfo_type get_streaminfo(const std::string &path)
+{
+	auto info = streaminfo_cache.find(path);
+	if (info)
+		return *info;
+
+	std::string file_path{sd_config.mount_point};
+	file_path += path;
+	basics::file::input<512> file_istream{file_path.data()};
+	auto streaminfo = audio::flac::streaminfo_type{};
+	if (file_istream.peek() == 'R') {
+		library::wav_format format{};
+		if (!library::read_wav_header(file_istream, format))
+			throw basics::error{"player: no PCM WAVE stream in '%s'", path.c_str()};
+		streaminfo = to_streaminfo(format);
+	} else {
+		streaminfo = audio::flac::decode_metadata(file_istream);
+	}
+	streaminfo_cache.insert(path, streaminfo);
+
+	return streaminfo;
+}
 
-	DIR *dp = ::opendir(dir_path.c_str());
-	if (dp == nullptr)
-		throw basics::error{"failed opening dir '%s'", dir_path.c_str()};
 
-	std::vector<std::string> files{};
-	struct dirent *ep = nullptr;
+// the playable track after play_file in play_dir, by name; none after the last one
+std::optional<std::string> get_next_album_track()
+{
+	auto dir_path = sd_config.mount_point + play_dir;
+	auto file = play_file;
 	for (;;) {
-		ep = ::readdir(dp);
-		if (ep == nullptr)
-			break;
+		auto next = album_index.next(dir_path, file);
+		if (!next)
+			return std::nullopt;
+		file = *next;
+
+		auto res = play_dir;
+		res += "/";
+		res += file;
+		try {
+			if (is_supported(get_streaminfo(res)))
+				return res;
+		} catch (...) {
+			// unreadable, skipped as well
+		}
+		std::cout << "player: skipped " << res << std::endl;
+	}
+}
 
-		if (ep->d_type == DT_DIR)
-			continue;
 
-		// TODO: filter unsupported files
-		files.emplace_back(ep->d_name);
+// the track to queue behind the current one, as per the play mode
+std::optional<std::string> get_next_track()
+{
+	if (play_mode == play_mode_type::once)
+		return std::nullopt;
+	if (play_mode == play_mode_type::loop)
+		return play_path;
+
+	/*if (play_mode == play_mode_type::album)*/
+	try {
+		return get_next_album_track();
+	} catch (basics::error& e) {
+		e.append("player: mode=album");
+		e.dump();
+	} catch (const std::exception &e) {
+		std::cerr << "error: mode=album: " << e.what() << std::endl;
 	}
-	::closedir(dp);
 
-	taskYIELD();
+	return std::nullopt;
+}
 
-	std::sort(files.begin(), files.end());
-	size_t i = 0;
-	for (; i < files.size() - 1; ++i) {
-		if (files[i] == play_file)
-			break;
+
+void set_play_path(const std::string &path)
+{
+	auto pos = path.rfind('/');
+	std::lock_guard<std::mutex> guard{path_lock};
+	play_path = path;
+	play_file = (pos == std::string::npos)? play_path : play_path.substr(pos + 1);
+	play_dir = play_path.substr(0, pos);
+}
+
+
+void set_stream_path(const std::string &host, uint16_t port)
+{
+	std::lock_guard<std::mutex> guard{path_lock};
+	play_dir.clear();
+	play_file = "tcp://" + host + ":" + std::to_string(port);
+	play_path = play_file;
+}
+
+
+/**
+* @brief A play session handed over to the decoder task, by the task owning the player.
+*
+* The session runs across tracks: the player keeps running while the decoder moves from the end
+* of a track straight into the next one, already read ahead.
+*/
+struct decode_job {
+	pcm56_player_type &player;
+	read_ahead_type &read_ahead;
+	net_stream_type *net;                   // the network stream played, instead of play_path
+	TaskHandle_t requester;
+	std::exception_ptr error;
+	std::optional<player_command> command;  // the play, stop or seek that ended the session
+	uint32_t skip;                          // samples to drop at the start, after a seek
+	uint64_t start_sample;                  // the first one played, after a seek
+	uint32_t start_count;                   // consumed_count as the session started
+	uint32_t output_count;                  // samples put into the player buffer
+	bool drain;  // the session ended with its last track, the player buffer is to be played out
+	std::atomic<bool> done;
+};
+
+TaskHandle_t decoder_task = nullptr;
+auto decode_request = std::atomic<decode_job *>{nullptr};
+
+
+// lets the decoder task, blocked on buffer space, see a new command
+void wake_decoder()
+{
+	if (decoder_task != nullptr)
+		xTaskNotifyGive(decoder_task);
+}
+
+
+// queues the command and wakes up both of its possible consumers; false when the queue is full
+bool send_command(cmd_type type, int32_t value = 0, std::string path = {})
+{
+	if (!commands.push(player_command{type, value, std::move(path), esp_timer_get_time()}))
+		return false;
+
+	wake_decoder();
+	if (player_task != nullptr)
+		xTaskNotifyGive(player_task);
+
+	return true;
+}
+
+
+pcm56_player::command_latency &latency_of(cmd_type type)
+{
+	return command_latencies[(size_t)type];
+}
+
+
+// volume and mode take effect on the consumer side; output_us is the time until the change is heard
+void apply_setting(const player_command &command, int64_t output_us = 0)
+{
+	if (command.type == cmd_type::volume)
+		volume = (int16_t)command.value;
+	else /*if (command.type == cmd_type::mode)*/
+		play_mode = (play_mode_type)command.value;
+
+	latency_of(command.type).record(esp_timer_get_time() - command.time_us + output_us);
+}
+
+
+// the track stream parameters, read off the start of the stream
+audio::flac::streaminfo_type read_metadata(flac_decoder_type &decoder)
+{
+	decoder.decode_marker();
+	while (decoder.state() != audio::flac::decoder_state::has_metadata)
+		decoder.decode_metadata();
+
+	return decoder.streaminfo();
+}
+
+
+audio::flac::streaminfo_type read_metadata(wav_decoder_type &decoder)
+{
+	decoder.decode_metadata();
+
+	return to_streaminfo(decoder.format());
+}
+
+
+bool is_complete(const flac_decoder_type &decoder)
+{
+	return (decoder.state() == audio::flac::decoder_state::complete);
+}
+
+
+bool is_complete(const wav_decoder_type &decoder)
+{
+	return decoder.complete();
+}
+
+
+// applies the pending settings and clock trim changes; false on a command that ends the track,
+// left in the job
+bool handle_commands(decode_job &job, int32_t &trim_ppm)
+{
+	for (auto command = commands.pop(); command; command = commands.pop()) {
+		if ((command->type == cmd_type::play) || (command->type == cmd_type::stop)
+				|| (command->type == cmd_type::seek) || (command->type == cmd_type::stream)) {
+			job.command = std::move(command);
+
+			return false;
+		}
+
+		// the new gain applies from the next block, heard once the buffer ahead of it is played
+		apply_setting(*command, player_buffer.size() * 1000000ll / player_sample_rate);
+	}
+
+	if (trim_ppm != clock_trim_ppm.load(std::memory_order_relaxed)) {
+		trim_ppm = clock_trim_ppm.load(std::memory_order_relaxed);
+		job.player.set_frequency_calibration(frequency_calibration(trim_ppm));
+		reset_clock_reference();
 	}
 
-	play_file = files[i + 1];
+	return true;
+}
 
-	auto res = play_dir;
-	res += "/";
-	res += play_file;
 
-	return res;
+// decodes the track to its end (true) or up to a command (false); the clock trim and the gain carry
+// over from track to track. on_started runs once the first block is in the buffer
+template<typename DECODER, typename CALLBACK>
+bool decode_track(DECODER &decoder, const audio::flac::streaminfo_type &info, bool resampling,
+					decode_job &job, int32_t &trim_ppm, int32_t &gain, CALLBACK &&on_started)
+{
+	auto started = false;
+	auto have_block = false;
+	auto block_pos = size_t{0};
+	auto conversion = std::optional<block_conversion<flac_sample_type>>{};
+	for (;;) {
+		if (!handle_commands(job, trim_ppm))
+			return false;
+
+		if (!have_block) {
+			auto decode_start = esp_timer_get_time();
+			decoder.decode_audio();
+			have_block = true;
+			block_pos = std::min<size_t>(job.skip, decoder.block_size());
+			job.skip -= block_pos;
+
+			// a network stream is pulled at the pace its sender's clock sets
+			if (job.net != nullptr)
+				resampler.steer(job.net->drift_ppm());
+
+			// volume changes ramp over the whole block, as played
+			auto target_gain = volume_gain(volume);
+			auto output_size = resampling?
+				resampler.output_count(decoder.block_size() - block_pos) : decoder.block_size() - block_pos;
+			conversion.emplace(info.channel_count, info.sample_bit_size, gain, target_gain, output_size);
+			gain = target_gain;
+
+			auto block_us = decoder.block_size() * 1000000ull / info.sample_rate;
+			auto load = (uint32_t)((esp_timer_get_time() - decode_start) * 1000 / (block_us? block_us : 1));
+			if (load > decode_load_max.load(std::memory_order_relaxed))
+				decode_load_max.store(load, std::memory_order_relaxed);
+
+			continue;
+		}
+
+		// have_block; the player wakes the task up once a slot is free, commands do as well
+		if (!player_buffer.wait_space(portMAX_DELAY))
+			continue;
+
+		const flac_sample_type *channels[] = {&decoder.block_data()[0][0], &decoder.block_data()[1][0]};
+
+		auto output_count = resampling?
+			resampler.output_count(decoder.block_size() - block_pos) : decoder.block_size() - block_pos;
+		auto written = player_buffer.put_block(output_count,
+			[&] (encoded_sample_type *data, size_t count) {
+				if (!resampling) {
+					(*conversion)(channels, block_pos, data, count);
+					block_pos += count;
+
+					return;
+				}
+
+				for (size_t done = 0; done < count; ) {
+					auto chunk = std::min(count - done, resampler.chunk_size);
+					resampler.run(channels, block_pos, chunk);
+					(*conversion)(resampler.output(), 0, data + done, chunk);
+					done += chunk;
+				}
+			});
+
+		job.output_count += written;
+		if (!started && (written != 0)) {
+			started = true;
+			on_started();
+		}
+		if (written < output_count)
+			continue;  // buffer full, the rest of the block goes in once a slot frees up
+		if (resampling)
+			resampler.absorb(channels, block_pos, decoder.block_size());
+		have_block = false;
+
+		if (is_complete(decoder))
+			return true;
+	}
 }
 
 
-void prepare_next_track()
+// passes the WAVE track to the player buffer as it is read, alike decode_track, with no blocks: the
+// frames go straight into the free buffer slots, a slot's worth or more at a time
+template<typename CALLBACK>
+bool pass_track(wav_decoder_type &decoder, decode_job &job, int32_t &trim_ppm, int32_t &gain,
+					CALLBACK &&on_started)
 {
-	if (play_mode == play_mode_type::once) {
-		state = state_type::ready;
-	} else if (play_mode == play_mode_type::loop) {
-		// play_path remains unchanged
-	} else /*if (play_mode == play_mode_type::album)*/ {
-		try {
-			play_path = get_next_album_track();
+	decoder.skip(job.skip);
+	job.skip = 0;
 
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-		} catch (basics::error& e) {
-			state = state_type::ready;
+	auto started = false;
+	for (;;) {
+		if (!handle_commands(job, trim_ppm))
+			return false;
 
-			e.append("player: mode=album");
-			e.dump();
-		} catch (const std::exception &e) {
-			state = state_type::ready;
+		// the player wakes the task up once a slot is free, commands do as well
+		if (!player_buffer.wait_space(portMAX_DELAY))
+			continue;
 
-			std::cerr << "error: mode=album: " << e.what() << std::endl;
-			;
+		// volume changes ramp over what is written at once
+		auto count = player_buffer.available();
+		auto target_gain = volume_gain(volume);
+		auto ramp = gain_ramp{gain, target_gain, count};
+		gain = target_gain;
+
+		auto pass_start = esp_timer_get_time();
+		// short at the end of the data: the next track's samples follow on from the last one written
+		auto written = player_buffer.put_block(count, [&decoder, &ramp] (encoded_sample_type *data, size_t size) {
+			return decoder.pass(data, size, ramp);
+		});
+		job.output_count += written;
+
+		auto written_us = written * 1000000ull / player_sample_rate;
+		auto load = (uint32_t)((esp_timer_get_time() - pass_start) * 1000 / (written_us? written_us : 1));
+		if (load > decode_load_max.load(std::memory_order_relaxed))
+			decode_load_max.store(load, std::memory_order_relaxed);
+
+		if (!started) {
+			started = true;
+			on_started();
 		}
+		if (decoder.complete())
+			return true;
 	}
 }
 
 
-void play_track()
+// plays play_path, or the network stream, through DECODER, with the next track queued behind it;
+// false when the session ends with it
+template<typename DECODER>
+bool play_track(std::istream &input, decode_job &job, int32_t &trim_ppm, int32_t &gain)
 {
-	std::string file_path{sd_config.mount_point};
-	file_path += play_path;
-	input_file_type file_istream{file_path.data()};
-	flac_decoder_type flac_decoder{file_istream};
-	std::cout << "player: track=" << file_path << std::endl;
-
-	flac_decoder.decode_marker();
-	while (flac_decoder.state() != audio::flac::decoder_state::has_metadata)
-		flac_decoder.decode_metadata();
-	auto info = flac_decoder.streaminfo();
+	DECODER decoder{input};
+	auto info = read_metadata(decoder);
 	pcm56_player::print_streaminfo(info);
+	if (job.net == nullptr)
+		streaminfo_cache.insert(play_path, info);
+	if (!is_supported(info))
+		throw basics::error{"player: unsupported stream '%s'", play_path.c_str()};
+
+	// the track plays once the buffer ahead of it has
+	track_start.store(job.start_count + job.output_count, std::memory_order_relaxed);
+	track_offset.store((uint32_t)(job.start_sample * player_sample_rate / info.sample_rate), std::memory_order_relaxed);
+	track_length.store((uint32_t)(info.sample_count * player_sample_rate / info.sample_rate), std::memory_order_relaxed);
+	job.start_sample = 0;
+
+	// the DAC clock stays at the player rate, other rates are converted; network streams always are,
+	// to follow their sender's clock. A track of the previous one's format converts on from its end
+	auto resampling = (info.sample_rate != player_sample_rate) || (job.net != nullptr);
+	if (resampling) {
+		resampler.configure(info.sample_rate, player_sample_rate, info.channel_count, info.sample_bit_size);
+		std::cout << "player: resampling " << info.sample_rate << " to " << player_sample_rate << " samples/second\n";
+	} else {
+		resampler.reset();
+	}
 
-	int sample_rshift = info.sample_bit_size - player_sample_bit_size;
-	std::cout << "player: sample rshifting by " << sample_rshift << " bits\n";
+	// the next track is looked up, opened and read ahead while this one plays, once its first block
+	// is in the buffer: the boundary is no time for directory reads
+	auto next_path = std::optional<std::string>{};
+	auto queue_next = [&job, &next_path] () {
+		next_path = (job.net == nullptr)? get_next_track() : std::nullopt;
+		if (!next_path)
+			return;
 
-	player_buffer.reset();
+		try {
+			job.read_ahead.queue((sd_config.mount_point + *next_path).c_str());
+		} catch (basics::error& e) {
+			e.append("player: next track");
+			e.dump();
+
+			next_path.reset();
+		}
+	};
+
+	// WAVE at the player rate passes through
+	auto done = false;
+	if constexpr (std::is_same_v<DECODER, wav_decoder_type>)
+		done = resampling? decode_track(decoder, info, resampling, job, trim_ppm, gain, queue_next)
+							: pass_track(decoder, job, trim_ppm, gain, queue_next);
+	else
+		done = decode_track(decoder, info, resampling, job, trim_ppm, gain, queue_next);
+	if (!done)
+		return false;
+
+	if (!next_path) {
+		state = state_type::ready;
+		job.drain = true;
+
+		return false;
+	}
+	set_play_path(*next_path);
+
+	return true;
+}
 
+
+// WAVE streams, known by the 'R' of their RIFF marker, go to the player as they are, FLAC ones
+// through the decoder
+bool play_input(std::istream &input, decode_job &job, int32_t &trim_ppm, int32_t &gain)
+{
+	if (input.peek() == 'R')
+		return play_track<wav_decoder_type>(input, job, trim_ppm, gain);
+
+	return play_track<flac_decoder_type>(input, job, trim_ppm, gain);
+}
+
+
+// plays play_path, then the tracks the play mode chains to it, gaplessly; or the network stream
+void decode_session(decode_job &job)
+{
+	auto trim_ppm = clock_trim_ppm.load(std::memory_order_relaxed);
+	auto gain = volume_gain(volume);
+	resampler.reset();  // a session starts off a discontinuity
+	if (job.net != nullptr) {
+		std::istream net_istream{job.net};
+		std::cout << "player: stream=" << play_path << std::endl;
+		play_input(net_istream, job, trim_ppm, gain);
+
+		return;
+	}
+
+	for (;;) {
+		input_file_type file_istream{job.read_ahead};
+		std::cout << "player: track=" << play_path << std::endl;
+		if (!play_input(file_istream, job, trim_ppm, gain))
+			return;
+	}
+}
+
+
+void decoder_main(void */*arg*/)
+{
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		auto *job = decode_request.exchange(nullptr, std::memory_order_acq_rel);
+		if (job == nullptr)
+			continue;  // a late buffer or command wake up
+
+		try {
+			decode_session(*job);
+		} catch (...) {
+			job->error = std::current_exception();
+		}
+
+		job->done.store(true, std::memory_order_release);
+		xTaskNotifyGive(job->requester);
+	}
+}
+
+
+void start_decoder()
+{
+	if (decoder_task != nullptr)
+		return;
+
+	if (xTaskCreatePinnedToCore(&decoder_main, "decoder", decoder_task_stack_size, nullptr,
+									decoder_task_priority, &decoder_task, decoder_task_core) != pdPASS)
+		throw basics::error{"player: decoder task creation failure"};
+}
+
+
+// queues play_path from the frame holding start_ms on
+pcm56_player::flac_seek_point queue_play_path(read_ahead_type &read_ahead, uint32_t start_ms)
+{
+	auto path = sd_config.mount_point + play_path;
+	if (start_ms == 0) {
+		read_ahead.queue(path.c_str());
+
+		return {0, 0, 0};
+	}
+
+	// WAVE frames are at fixed offsets, after a header written anew for the rest of the data
+	auto point = pcm56_player::flac_seek_point{};
 	{
-		pcm56_player_type player{player_config, player_buffer, info.sample_rate, frequency_calibration};
+		basics::file::input<512> file_istream{path.data()};
+		if (file_istream.peek() == 'R') {
+			library::wav_format format{};
+			if (!library::read_wav_header(file_istream, format))
+				throw basics::error{"player: no PCM WAVE stream in '%s'", play_path.c_str()};
+
+			auto frame = (uint64_t)start_ms * format.sample_rate / 1000;
+			if (format.sample_count != 0)
+				frame = std::min(frame, format.sample_count - 1);
+			char head[pcm56_player::wav_head_size];
+			pcm56_player::make_wav_head(format, format.sample_count? format.sample_count - frame : 0, head);
+			point = {(long)(format.data_offset + frame * format.block_align), frame, 0};
+			read_ahead.queue(path.c_str(), point.offset, {head, sizeof(head)});
+
+			return point;
+		}
+	}
 
-		auto have_block = false;
-		for (;;) {
-			if (cmd == cmd_type::stop) {
-				cmd = cmd_type::idle;
-				state = state_type::ready;
-				std::cout << "player: cmd=stop" << std::endl;
+	char head[pcm56_player::flac_seeker::head_size];
+	{
+		pcm56_player::flac_seeker seeker{path.c_str()};
+		point = seeker.find((uint64_t)start_ms * seeker.sample_rate() / 1000);
+		seeker.head().copy(head, sizeof(head));
+		std::cout << "player: seek=" << start_ms << "ms, frame at " << point.offset << " + " << point.skip
+					<< " samples, " << seeker.read_count() << " reads" << std::endl;
+	}
+	read_ahead.queue(path.c_str(), point.offset, {head, sizeof(head)});
 
-				break;
-			}
+	return point;
+}
 
-			if (cmd == cmd_type::play) {
-				cmd = cmd_type::idle;
-				state = state_type::play;
-				std::cout << "player: cmd=play" << std::endl;
 
-				break;
-			}
+// plays play_path as requested, by a play or a seek command, or the network stream of a stream
+// command; returns the play, seek or stream command that cut the session short
+std::optional<player_command> play_session(read_ahead_type &read_ahead, const player_command &request)
+{
+	player_buffer.reset();
+	auto net = std::optional<net_stream_type>{};
+	auto point = pcm56_player::flac_seek_point{0, 0, 0};
+	if (request.type == cmd_type::stream)
+		net.emplace(net_stats, request.path.c_str(), (uint16_t)request.value, net_stream_core, net_stream_priority);
+	else
+		point = queue_play_path(read_ahead, (request.type == cmd_type::seek)? request.value : 0);
+
+	auto error = std::exception_ptr{};
+	auto command = std::optional<player_command>{};
+	{
+		auto start_count = playback_stats.start_count.load(std::memory_order_relaxed);
+		auto starting = true;
+		auto check_start = [&] () {
+			if (!starting || (playback_stats.start_count.load(std::memory_order_acquire) == start_count))
+				return;
+
+			latency_of(request.type).record((int32_t)(playback_stats.start_us.load(std::memory_order_relaxed)
+																- (uint32_t)request.time_us));
+			starting = false;
+		};
+
+		// the player, and its timer ISR, stay on this core; the decoding goes to the decoder task
+		pcm56_player_type player{output_config(), player_buffer, playback_stats, player_sample_rate,
+									frequency_calibration(clock_trim_ppm.load(std::memory_order_relaxed))};
+		reset_clock_reference();
+
+		// the decoder consumes the commands until done
+		decode_job job{player, read_ahead, net? &*net : nullptr, xTaskGetCurrentTaskHandle(), nullptr, std::nullopt, point.skip,
+						point.sample + point.skip, playback_stats.consumed_count.load(std::memory_order_relaxed), 0,
+						false, false};
+		decode_request.store(&job, std::memory_order_release);
+		xTaskNotifyGive(decoder_task);
+		while (!job.done.load(std::memory_order_acquire)) {
+			// polled for the first sample out, then woken up when done
+			ulTaskNotifyTake(pdTRUE, starting? 1 : portMAX_DELAY);
+			check_start();
+		}
 
-			if (!have_block) {
-				flac_decoder.decode_audio();
-				have_block = true;
+		// the tail of the last track is still buffered
+		while (job.drain && (player_buffer.size() > 0) && commands.empty()) {
+			vTaskDelay(10 / portTICK_PERIOD_MS);
+			check_start();
+		}
 
-				continue;
-			}
+		error = job.error;
+		command = std::move(job.command);
+	}
 
-			// have_block
-			if (!player_buffer.need_data()) {
-				taskYIELD();
+	read_ahead.close();
+	if (command && (command->type == cmd_type::stop)) {
+		// the player is gone, the output silent
+		latency_of(cmd_type::stop).record(esp_timer_get_time() - command->time_us);
+		state = state_type::ready;
+		std::cout << "player: cmd=stop" << std::endl;
 
-				continue;
-			}
+		command.reset();
+	}
 
-			int rshift = sample_rshift - volume;
-
-			if (rshift == 0) {
-				for (auto i = size_t{0}; i < flac_decoder.block_size(); ++i)
-					player_buffer.template put<task_operation>(stereo_sample_type{
-						(player_sample_type)flac_decoder.block_data()[0][i],
-										(player_sample_type)flac_decoder.block_data()[1][i]});
-			} else if (rshift >= 0) {
-				for (auto i = size_t{0}; i < flac_decoder.block_size(); ++i)
-					player_buffer.template put<task_operation>(stereo_sample_type{
-						(player_sample_type)(flac_decoder.block_data()[0][i] >> rshift),
-										(player_sample_type)(flac_decoder.block_data()[1][i] >> rshift)});
-			} else { // (rshift < 0)
-				for (auto i = size_t{0}; i < flac_decoder.block_size(); ++i)
-					player_buffer.template put<task_operation>(stereo_sample_type{
-						(player_sample_type)(flac_decoder.block_data()[0][i] << -rshift),
-										(player_sample_type)(flac_decoder.block_data()[1][i] << -rshift)});
-			}
-			have_block = false;
+	if (error)
+		std::rethrow_exception(error);
 
-			if (flac_decoder.state() == audio::flac::decoder_state::complete)
-				break;
+	return command;
+}
 
-			taskYIELD();
+
+// output samples of the playing track played so far
+uint32_t track_position()
+{
+	auto played = (int32_t)(playback_stats.consumed_count.load(std::memory_order_relaxed)
+								- track_start.load(std::memory_order_relaxed));
+
+	return std::min(std::max(played, 0) + track_offset.load(std::memory_order_relaxed),
+					track_length.load(std::memory_order_relaxed));
+}
+
+
+static const size_t state_field_count = 8;
+static const char *state_fields[state_field_count] = {"status", "dir", "file", "mode", "volume", "position",
+														"length", "rate"};
+
+// the state as JSON values, by state_fields
+std::array<std::string, state_field_count> state_values()
+{
+	auto playing = (state == state_type::play);
+	auto quoted = [] (std::string_view value) {
+		return "\"" + json_escape(value) + "\"";
+	};
+
+	std::stringstream volume_value{};
+	volume_value << volume / 2.0;
+
+	std::string dir{};
+	std::string file{};
+	{
+		std::lock_guard<std::mutex> guard{path_lock};
+		dir = playing? play_dir : current_dir;
+		file = playing? play_file : "";
+	}
+
+	return {
+		quoted((state == state_type::init)? "starting..." :
+				(state == state_type::has_connection)? "no sd-card" :
+				(state == state_type::ready)? "ready" : "playing"),
+		quoted(dir),
+		quoted(file),
+		quoted((play_mode == play_mode_type::once)? "once" : (play_mode == play_mode_type::loop)? "loop" : "album"),
+		volume_value.str(),
+		std::to_string(playing? track_position() : 0),
+		std::to_string(playing? track_length.load(std::memory_order_relaxed) : 0),
+		std::to_string(player_sample_rate),
+	};
+}
+
+
+// pushes the state fields that changed to the WebSocket clients, every state_push_period_ms at
+// most; the whole state when a client joins
+void state_push_main(void *arg)
+{
+	auto server = (httpd_handle_t)arg;
+	std::array<std::string, state_field_count> pushed{};
+	for (;;) {
+		vTaskDelay(state_push_period_ms / portTICK_PERIOD_MS);
+		if (pcm56_player::ws_client_count(server) == 0)
+			continue;
+
+		auto full = state_full_push.exchange(false, std::memory_order_relaxed);
+		auto values = state_values();
+		auto count = size_t{0};
+		std::string message{"{"};
+		for (size_t i = 0; i < state_field_count; ++i) {
+			if (!full && (values[i] == pushed[i]))
+				continue;
+
+			message += (count++? ",\"" : "\"");
+			message += state_fields[i];
+			message += "\":";
+			message += values[i];
+			pushed[i] = std::move(values[i]);
 		}
+		message += "}";
+
+		if (count != 0)
+			pcm56_player::ws_broadcast(server, message);
 	}
+}
+
 
-	if ((state == state_type::play) && (flac_decoder.state() == audio::flac::decoder_state::complete))
-		prepare_next_track();
+TaskHandle_t state_push_task = nullptr;
+
+void start_state_push(httpd_handle_t server)
+{
+	if ((state_push_task != nullptr) || (server == nullptr))
+		return;
+
+	if (xTaskCreatePinnedToCore(&state_push_main, "state_push", state_push_stack_size, server,
+									state_push_priority, &state_push_task, state_push_core) != pdPASS)
+		throw basics::error{"httpd: state push task creation failure"};
 }
 
 
@@ -289,50 +1030,96 @@ httpd_uri_t main_page_handler = {
 	.user_ctx = nullptr
 };
 
+// GET /list?<base64 dir>[&offset=<n>][&limit=<n>] streams the directory entries as a JSON array;
+// the ETag hashes the full listing, X-Total-Count tells the number of entries
 httpd_uri_t list_handler = {
 	.uri = "/list",
 	.method = HTTP_GET,
 	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		DIR *dp = nullptr;
+		pcm56_player::chunked_response<> response{req};
 		try {
-			std::string dir_path = std::string{req->uri}.substr(6);  // HACK: parse params properly
-			dir_path = basics::base64::decode(dir_path.c_str(), dir_path.size());
+			auto query = std::string_view{req->uri}.substr(6);
+			auto separator = query.find('&');
+			auto params = std::string{(separator == std::string_view::npos)? "" : query.substr(separator + 1)};
+			query = query.substr(0, separator);
+			std::string dir_path = basics::base64::decode(query.data(), query.size());
 			std::cout << "http_ui: GET /list " << req->uri << "; dir=" << dir_path << std::endl;
 
+			auto offset = size_t{0};
+			auto limit = SIZE_MAX;
+			char value[12];
+			if (httpd_query_key_value(params.c_str(), "offset", value, sizeof(value)) == ESP_OK)
+				offset = strtoul(value, nullptr, 10);
+			if (httpd_query_key_value(params.c_str(), "limit", value, sizeof(value)) == ESP_OK)
+				limit = strtoul(value, nullptr, 10);
+
 			if (!card_detect.card_present())
 				throw basics::error{"sd_card: no card present"};
 
-			current_dir = dir_path;
+			{
+				std::lock_guard<std::mutex> guard{path_lock};
+				current_dir = dir_path;
+			}
 			dir_path = sd_config.mount_point + dir_path;
 
-			DIR *dp = nullptr;
 			dp = ::opendir(dir_path.c_str());
 			if (dp == nullptr)
 				throw basics::error{"httpd: failed opening dir '%s'", dir_path.c_str()};
 
-			bool first{true};
+			// a first pass hashes (FNV-1a) and counts the entries; FAT updates no directory mtime
+			auto hash = uint32_t{2166136261};
+			auto total = size_t{0};
 			struct dirent *ep = nullptr;
+			while ((ep = ::readdir(dp)) != nullptr) {
+				for (const char *c = ep->d_name; ; ++c) {
+					hash = (hash ^ (uint8_t)*c) * 16777619;
+					if (*c == '\0')
+						break;
+				}
+				hash = (hash ^ ep->d_type) * 16777619;
+				++total;
+			}
 
-			std::stringstream ostream{};
+			char etag[12];
+			char match[12];
+			char total_count[12];
+			snprintf(etag, sizeof(etag), "\"%08" PRIx32 "\"", hash);
+			snprintf(total_count, sizeof(total_count), "%zu", total);
+			httpd_resp_set_hdr(req, "ETag", etag);
+			httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+			if ((httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK)
+					&& (strcmp(match, etag) == 0)) {
+				::closedir(dp);
+				httpd_resp_set_status(req, "304 Not Modified");
+
+				return httpd_resp_send(req, nullptr, 0);
+			}
 
 			httpd_resp_set_type(req, "application/json");
-			ostream << "[";
-			for (;;) {
-				ep = ::readdir(dp);
-				if (ep == nullptr)
-					break;
+			httpd_resp_set_hdr(req, "X-Total-Count", total_count);
 
-				ostream << (first? "" : ",")
+			response << "[";
+			::rewinddir(dp);
+			for (size_t i = 0, count = 0; (count < limit) && ((ep = ::readdir(dp)) != nullptr); ++i) {
+				if (i < offset)
+					continue;
+
+				response << (count? "," : "")
 						<< "{\"t\":\"" << ((ep->d_type == DT_DIR)? "d" : "f") << "\",\"n\":\""
-						<< ep->d_name << "\"}";
-				first = false;
+						<< pcm56_player::json_text{ep->d_name} << "\"}";
+				++count;
 			}
 			::closedir(dp);
 
-			ostream << "]";
-			return httpd_resp_sendstr(req, ostream.str().c_str());
+			response << "]";
+			return response.finish();
 
 		} catch (...) {
-			return httpd_resp_sendstr(req, "error");
+			if (dp != nullptr)
+				::closedir(dp);
+
+			return response.fail("error");
 		}
 	},
 	.user_ctx = nullptr
@@ -343,30 +1130,21 @@ httpd_uri_t play_handler = {
 	.method = HTTP_GET,
 	.handler = [] (httpd_req_t *req) -> esp_err_t {
 		try {
-			play_path = std::string{req->uri}.substr(6);  // TODO: create a param parser
-			play_path = basics::base64::decode(play_path.c_str(), play_path.size());
-			std::cout << "http_ui: GET " << req->uri << "; file=" << play_path << std::endl;
+			auto path = std::string{req->uri}.substr(6);  // TODO: create a param parser
+			path = basics::base64::decode(path.c_str(), path.size());
+			std::cout << "http_ui: GET " << req->uri << "; file=" << path << std::endl;
 
 			if (!card_detect.card_present())
 				return httpd_resp_send(req, "[error: no card]", HTTPD_RESP_USE_STRLEN);
 
-			{
-				std::string file_path{sd_config.mount_point};
-				file_path += play_path;
-				basics::file::input<512> file_istream{file_path.data()};
-				auto streaminfo = audio::flac::decode_metadata(file_istream);
-
-				if (streaminfo.channel_count > player_channel_count)
-					return httpd_resp_send(req, "[error: not stereo]", HTTPD_RESP_USE_STRLEN);
-				if (streaminfo.sample_rate > player_sample_rate)
-					return httpd_resp_send(req, "[error: bad rate]", HTTPD_RESP_USE_STRLEN);
-			}
-
-			auto pos = play_path.rfind('/');
-			play_file = (pos == std::string::npos)? play_path : play_path.substr(pos + 1);
-			play_dir = play_path.substr(0, pos);
+			auto streaminfo = get_streaminfo(path);
+			if (streaminfo.channel_count > player_channel_count)
+				return httpd_resp_send(req, "[error: not stereo]", HTTPD_RESP_USE_STRLEN);
+			if (streaminfo.sample_rate > player_max_sample_rate)
+				return httpd_resp_send(req, "[error: bad rate]", HTTPD_RESP_USE_STRLEN);
 
-			cmd = cmd_type::play;
+			if (!send_command(cmd_type::play, 0, path))
+				return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
 
 			return httpd_resp_send(req, "play", HTTPD_RESP_USE_STRLEN);
 		} catch (basics::error& e) {
@@ -387,30 +1165,94 @@ httpd_uri_t stop_handler = {
 	.uri = "/stop",
 	.method = HTTP_GET,
 	.handler = [] (httpd_req_t *req) -> esp_err_t {
-		cmd = cmd_type::stop;
-
 		std::cout << "http_ui: GET " << req->uri << std::endl;
+		if (!send_command(cmd_type::stop))
+			return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
+
 		return httpd_resp_send(req, "stop", HTTPD_RESP_USE_STRLEN);
 	},
 	.user_ctx = nullptr
 };
 
+// GET /seek?t=<seconds> moves the playback within the current track
+httpd_uri_t seek_handler = {
+	.uri = "/seek",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		std::cout << "http_ui: GET " << req->uri << std::endl;
+		httpd_resp_set_type(req, "application/json");
+
+		char value[16];
+		auto query = std::string_view{req->uri}.substr(5);
+		if (query.empty() || (httpd_query_key_value(query.data() + 1, "t", value, sizeof(value)) != ESP_OK))
+			return httpd_resp_send(req, "[error: bad position]", HTTPD_RESP_USE_STRLEN);
+
+		auto seconds = strtod(value, nullptr);
+		if (!(seconds >= 0) || (seconds > INT32_MAX / 1000))
+			return httpd_resp_send(req, "[error: bad position]", HTTPD_RESP_USE_STRLEN);
+		if (state != state_type::play)
+			return httpd_resp_send(req, "[error: not playing]", HTTPD_RESP_USE_STRLEN);
+		if (!send_command(cmd_type::seek, (int32_t)(seconds * 1000)))
+			return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
+
+		std::stringstream ostream{};
+		ostream << "{\"seek\":" << seconds << "}";
+
+		return httpd_resp_sendstr(req, ostream.str().c_str());
+	},
+	.user_ctx = nullptr
+};
+
+// GET /stream?host=<address>&port=<n> plays the PCM WAVE or FLAC stream a server sends on connection
+httpd_uri_t stream_handler = {
+	.uri = "/stream",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		std::cout << "http_ui: GET " << req->uri << std::endl;
+		httpd_resp_set_type(req, "application/json");
+
+		char host[64];
+		char port[8];
+		auto query = std::string_view{req->uri}.substr(7);
+		if (query.empty() || (httpd_query_key_value(query.data() + 1, "host", host, sizeof(host)) != ESP_OK)
+				|| (httpd_query_key_value(query.data() + 1, "port", port, sizeof(port)) != ESP_OK))
+			return httpd_resp_send(req, "[error: bad source]", HTTPD_RESP_USE_STRLEN);
+
+		auto port_value = strtoul(port, nullptr, 10);
+		if ((port_value == 0) || (port_value > UINT16_MAX))
+			return httpd_resp_send(req, "[error: bad source]", HTTPD_RESP_USE_STRLEN);
+		if (!send_command(cmd_type::stream, (int32_t)port_value, host))
+			return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
+
+		std::stringstream ostream{};
+		ostream << "{\"stream\":\"" << json_escape(host) << ":" << port_value << "\"}";
+
+		return httpd_resp_sendstr(req, ostream.str().c_str());
+	},
+	.user_ctx = nullptr
+};
+
 httpd_uri_t volume_handler = {
 	.uri = "/volume",
 	.method = HTTP_GET,
 	.handler = [] (httpd_req_t *req) -> esp_err_t {
 		httpd_resp_set_type(req, "application/json");
 
+		// relative to the last requested volume, whether applied yet or not
+		auto target = requested_volume;
 		if (std::string{req->uri}.substr(8) == "up") {
-			if (volume < 1)
-				++volume;
+			if (target < player_volume_max)
+				++target;
 		} else {
-			if (volume > -6)
-				--volume;
+			if (target > player_volume_min)
+				--target;
 		}
+		if (!send_command(cmd_type::volume, target))
+			return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
+		requested_volume = target;
 
 		std::stringstream ostream{};
-		ostream << "{\"volume\":" << volume << "}";
+		ostream << "{\"volume\":" << target / 2.0 << "}";
 
 		std::cout << "http_ui: GET " << req->uri << " " << ostream.str() << std::endl;
 		return httpd_resp_sendstr(req, ostream.str().c_str());
@@ -426,13 +1268,16 @@ httpd_uri_t mode_handler = {
 
 		auto mode = std::string{req->uri}.substr(6);
 
+		auto value = play_mode_type{};
 		if (mode == "once") {
-			play_mode = play_mode_type::once;
+			value = play_mode_type::once;
 		} else if (mode == "loop") {
-			play_mode = play_mode_type::loop;
+			value = play_mode_type::loop;
 		} else /*if (mode == "album")*/ {
-			play_mode = play_mode_type::album;
+			value = play_mode_type::album;
 		}
+		if (!send_command(cmd_type::mode, (int32_t)value))
+			return httpd_resp_send(req, "[error: busy]", HTTPD_RESP_USE_STRLEN);
 
 		std::stringstream ostream{};
 		ostream << "{\"mode\":\"" << mode << "\"}";
@@ -449,25 +1294,292 @@ httpd_uri_t state_handler = {
 	.handler = [] (httpd_req_t *req) -> esp_err_t {
 		httpd_resp_set_type(req, "application/json");
 
+		auto values = state_values();
+		std::stringstream ostream{};
+		ostream << "{";
+		for (size_t i = 0; i < state_field_count; ++i)
+			ostream << (i? "," : "") << "\"" << state_fields[i] << "\":" << values[i];
+		ostream << "}";
+
+		return httpd_resp_sendstr(req, ostream.str().c_str());
+	},
+	.user_ctx = nullptr
+};
+
+// WebSocket /events: the state, pushed as it changes (see state_push_main); client messages are
+// read and dropped
+httpd_uri_t events_handler = {
+	.uri = "/events",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		if (req->method == HTTP_GET) {
+			std::cout << "http_ui: GET " << req->uri << " (WebSocket)" << std::endl;
+			state_full_push.store(true, std::memory_order_relaxed);
+
+			return ESP_OK;
+		}
+
+		httpd_ws_frame_t frame{};
+		auto err = httpd_ws_recv_frame(req, &frame, 0);
+		if ((err != ESP_OK) || (frame.len == 0))
+			return err;
+		if (frame.len > 128)
+			return ESP_FAIL;
+
+		uint8_t payload[128];
+		frame.payload = payload;
+
+		return httpd_ws_recv_frame(req, &frame, frame.len);
+	},
+	.user_ctx = nullptr,
+	.is_websocket = true,
+	.handle_ws_control_frames = false,
+	.supported_subprotocol = nullptr
+};
+
+httpd_uri_t stats_handler = {
+	.uri = "/stats",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		httpd_resp_set_type(req, "application/json");
+
+		std::stringstream ostream{};
+		ostream << "{\"underruns\":" << playback_stats.underrun_count.load(std::memory_order_relaxed) << ","
+				<< "\"concealed\":" << playback_stats.concealed_count.load(std::memory_order_relaxed) << ","
+				<< "\"worst_gap\":" << playback_stats.worst_gap.load(std::memory_order_relaxed) << ","
+				<< "\"buffer_fill\":" << player_buffer.size() << ","
+				<< "\"buffer_size\":" << player_buffer.capacity << ","
+				<< "\"decode_load_max\":" << decode_load_max.load(std::memory_order_relaxed) << ","
+				<< "\"sd\":{\"fill\":" << sd_stats.fill.load(std::memory_order_relaxed) << ","
+				<< "\"size\":" << read_ahead_type::block_size * read_ahead_type::block_count << ","
+				<< "\"reads\":" << sd_stats.read_count.load(std::memory_order_relaxed) << ","
+				<< "\"p50_us\":" << sd_stats.percentile(50) << ","
+				<< "\"p90_us\":" << sd_stats.percentile(90) << ","
+				<< "\"p99_us\":" << sd_stats.percentile(99) << ","
+				<< "\"max_us\":" << sd_stats.max_us.load(std::memory_order_relaxed) << ","
+				<< "\"bytes_per_s\":" << sd_stats.throughput() << ","
+				<< "\"stalls\":" << sd_stats.stall_count.load(std::memory_order_relaxed) << ","
+				<< "\"errors\":" << sd_stats.error_count.load(std::memory_order_relaxed) << "},"
+				<< "\"net\":{\"fill\":" << net_stats.fill.load(std::memory_order_relaxed) << ","
+				<< "\"size\":" << net_stream_type::block_size * net_stream_type::block_count << ","
+				<< "\"target\":" << net_stats.target.load(std::memory_order_relaxed) << ","
+				<< "\"bytes_per_s\":" << net_stats.byte_rate.load(std::memory_order_relaxed) << ","
+				<< "\"jitter_us\":" << net_stats.jitter_us.load(std::memory_order_relaxed) << ","
+				<< "\"drift_ppm\":" << net_stats.drift_ppm.load(std::memory_order_relaxed) << ","
+				<< "\"bytes\":" << net_stats.byte_count.load(std::memory_order_relaxed) << ","
+				<< "\"underruns\":" << net_stats.underrun_count.load(std::memory_order_relaxed) << ","
+				<< "\"errors\":" << net_stats.error_count.load(std::memory_order_relaxed) << "},"
+				<< "\"latency\":{";
+		static const char *cmd_names[cmd_type_count] = {"play", "stop", "volume", "mode", "seek", "stream"};
+		for (size_t i = 0; i < cmd_type_count; ++i) {
+			auto &latency = command_latencies[i];
+			ostream << (i? "," : "") << "\"" << cmd_names[i] << "\":{"
+					<< "\"count\":" << latency.count.load(std::memory_order_relaxed) << ","
+					<< "\"last_us\":" << latency.last_us.load(std::memory_order_relaxed) << ","
+					<< "\"max_us\":" << latency.max_us.load(std::memory_order_relaxed) << ","
+					<< "\"mean_us\":" << latency.mean_us() << "}";
+		}
+		ostream << "}}";
+
+		if (std::string{req->uri} == "/stats?reset") {
+			playback_stats.reset();
+			sd_stats.reset();
+			net_stats.reset();
+			decode_load_max.store(0, std::memory_order_relaxed);
+			for (auto &latency : command_latencies)
+				latency.reset();
+		}
+
+		return httpd_resp_sendstr(req, ostream.str().c_str());
+	},
+	.user_ctx = nullptr
+};
+
+// GET /clock reports the trim and the sample rate measured since the player started (or was
+// retuned) against esp_timer; GET /clock?ppm=<trim> sets and persists the trim
+httpd_uri_t clock_handler = {
+	.uri = "/clock",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		try {
+			auto uri = std::string{req->uri};
+			if (uri.rfind("/clock?ppm=", 0) == 0) {
+				auto trim_ppm = std::clamp<int32_t>(std::stol(uri.substr(11)), -clock_trim_limit_ppm, clock_trim_limit_ppm);
+				store_clock_trim(trim_ppm);
+				clock_trim_ppm.store(trim_ppm, std::memory_order_relaxed);
+			}
+
+			auto elapsed_us = esp_timer_get_time() - clock_reference_us.load(std::memory_order_relaxed);
+			auto played = playback_stats.played_count.load(std::memory_order_relaxed)
+							- clock_reference_count.load(std::memory_order_relaxed);
+			auto measured_rate = ((state == state_type::play) && (elapsed_us > 0))? played * 1e6 / elapsed_us : 0.0;
+
+			httpd_resp_set_type(req, "application/json");
+			std::stringstream ostream{};
+			ostream.precision(10);
+			ostream << "{\"trim_ppm\":" << clock_trim_ppm.load(std::memory_order_relaxed) << ","
+					<< "\"nominal_rate\":" << player_sample_rate << ","
+					<< "\"measured_rate\":" << measured_rate << ","
+					<< "\"measured_ppm\":" << (measured_rate? (measured_rate / player_sample_rate - 1) * 1e6 : 0.0) << ","
+					<< "\"window_s\":" << elapsed_us / 1000000 << "}";
+
+			std::cout << "http_ui: GET " << req->uri << " " << ostream.str() << std::endl;
+			return httpd_resp_sendstr(req, ostream.str().c_str());
+		} catch (basics::error& e) {
+			e.dump();
+
+			return httpd_resp_send(req, "[error: cannot store]", HTTPD_RESP_USE_STRLEN);
+		} catch (...) {
+			return httpd_resp_send(req, "[error: bad trim]", HTTPD_RESP_USE_STRLEN);
+		}
+	},
+	.user_ctx = nullptr
+};
+
+httpd_uri_t metrics_handler = {
+	.uri = "/metrics",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		httpd_resp_set_type(req, "application/json");
+
+		auto &profile = playback_stats.profile;
+		auto count = profile.count.load(std::memory_order_relaxed);
+
 		std::stringstream ostream{};
-		ostream << "{\"status\":\"" << ((state == state_type::init)? "starting..." :
-										(state == state_type::has_connection)? "no sd-card" :
-										(state == state_type::ready)? "ready" : "playing") << "\","
-				<< "\"dir\":\""  << ((state == state_type::play)? play_dir : current_dir) << "\","
-				<< "\"file\":\"" << ((state == state_type::play)? play_file : "") << "\","
-				<< "\"mode\":\"" << ((play_mode == play_mode_type::once)? "once" :
-									 (play_mode == play_mode_type::loop)? "loop" : "album") << "\","
-				<< "\"volume\":" << volume << "}";
-
-		std::cout << "http_ui: GET " << req->uri << " : " << ostream.str() << std::endl;
+		ostream << "{\"isr\":{\"enabled\":" << (player_profiling? "true" : "false") << ","
+				<< "\"count\":" << count << ","
+				<< "\"min\":" << (count? profile.min.load(std::memory_order_relaxed) : 0) << ","
+				<< "\"max\":" << profile.max.load(std::memory_order_relaxed) << ","
+				<< "\"mean\":" << profile.mean.load(std::memory_order_relaxed) << ","
+				<< "\"budget\":" << esp_rom_get_cpu_ticks_per_us() * 1000000 / player_sample_rate << ","
+				<< "\"histogram\":[";
+		for (size_t i = 0; i < isr_profile::bucket_count; ++i)
+			ostream << (i? "," : "") << profile.histogram[i].load(std::memory_order_relaxed);
+		ostream << "]}}";
+
+		if (std::string{req->uri} == "/metrics?reset")
+			profile.reset();
+
 		return httpd_resp_sendstr(req, ostream.str().c_str());
 	},
 	.user_ctx = nullptr
 };
 
+// GET /library reports the scan and the index; ?scan starts a scan; ?artists lists the artists,
+// ?artist=<base64 name> the albums of one, ?album=<index> the tracks of one; ?search=<base64 text>
+// finds tracks by title, album or artist
+httpd_uri_t library_handler = {
+	.uri = "/library",
+	.method = HTTP_GET,
+	.handler = [] (httpd_req_t *req) -> esp_err_t {
+		try {
+			auto uri = std::string{req->uri};
+			std::cout << "http_ui: GET " << uri << std::endl;
+			httpd_resp_set_type(req, "application/json");
+
+			if (!card_detect.card_present())
+				throw basics::error{"sd_card: no card present"};
+
+			auto track_json = [] (library::index_reader &index, uint32_t i) {
+				auto track = index.track(i);
+				std::stringstream ostream{};
+				ostream << "{\"p\":\"" << json_escape(index.string(track.path)) << "\","
+						<< "\"t\":\"" << json_escape(index.string(track.title)) << "\","
+						<< "\"n\":" << track.number << ","
+						<< "\"s\":" << track.seconds << "}";
+
+				return ostream.str();
+			};
+
+			std::stringstream ostream{};
+			if (uri == "/library?scan") {
+				ostream << "{\"scan\":" << (library_scanner.start()? "true" : "false") << "}";
+
+				return httpd_resp_sendstr(req, ostream.str().c_str());
+			}
+
+			std::lock_guard<std::mutex> guard{library_scanner.lock()};
+			if (uri == "/library") {
+				auto state = library_scanner.state();
+				ostream << "{\"state\":\"" << ((state == library::scan_state::idle)? "idle" :
+												(state == library::scan_state::scanning)? "scanning" :
+												(state == library::scan_state::done)? "done" : "failed") << "\","
+						<< "\"scanned\":" << library_scanner.count() << ","
+						<< "\"truncated\":" << (library_scanner.truncated()? "true" : "false");
+				try {
+					library::index_reader index{library_scanner.index_path().c_str()};
+					ostream << ",\"artists\":" << index.header().artist_count << ","
+							<< "\"albums\":" << index.header().album_count << ","
+							<< "\"tracks\":" << index.header().track_count;
+				} catch (const std::exception &) {
+					// no index yet
+				}
+				ostream << "}";
+
+				return httpd_resp_sendstr(req, ostream.str().c_str());
+			}
+
+			library::index_reader index{library_scanner.index_path().c_str()};
+			if (uri == "/library?artists") {
+				ostream << "[";
+				for (uint32_t i = 0; i < index.header().artist_count; ++i) {
+					auto artist = index.artist(i);
+					ostream << (i? "," : "") << "{\"n\":\"" << json_escape(index.string(artist.name)) << "\","
+							<< "\"a\":" << artist.album_count << "}";
+				}
+				ostream << "]";
+			} else if (uri.rfind("/library?artist=", 0) == 0) {
+				auto name = uri.substr(16);
+				name = basics::base64::decode(name.c_str(), name.size());
+				auto i = index.find_artist(name);
+				if (!i)
+					return httpd_resp_sendstr(req, "[]");
+
+				auto artist = index.artist(*i);
+				ostream << "[";
+				for (auto j = artist.first_album; j < artist.first_album + artist.album_count; ++j) {
+					auto album = index.album(j);
+					ostream << ((j != artist.first_album)? "," : "") << "{\"i\":" << j << ","
+							<< "\"n\":\"" << json_escape(index.string(album.name)) << "\","
+							<< "\"t\":" << album.track_count << "}";
+				}
+				ostream << "]";
+			} else if (uri.rfind("/library?album=", 0) == 0) {
+				auto album = index.album(std::stoul(uri.substr(15)));
+				ostream << "[";
+				for (auto k = album.first_track; k < album.first_track + album.track_count; ++k)
+					ostream << ((k != album.first_track)? "," : "") << track_json(index, k);
+				ostream << "]";
+			} else if (uri.rfind("/library?search=", 0) == 0) {
+				auto text = uri.substr(16);
+				text = basics::base64::decode(text.c_str(), text.size());
+				auto tracks = index.search(text, library_search_limit);
+				ostream << "[";
+				for (size_t k = 0; k < tracks.size(); ++k)
+					ostream << (k? "," : "") << track_json(index, tracks[k]);
+				ostream << "]";
+			} else {
+				return httpd_resp_send(req, "[error: bad request]", HTTPD_RESP_USE_STRLEN);
+			}
+
+			return httpd_resp_sendstr(req, ostream.str().c_str());
+		} catch (basics::error& e) {
+			e.dump();
+
+			return httpd_resp_send(req, "[error: no card]", HTTPD_RESP_USE_STRLEN);
+		} catch (const std::exception &e) {
+			std::cerr << "error: library: " << e.what() << std::endl;
+
+			return httpd_resp_send(req, "[error: no library]", HTTPD_RESP_USE_STRLEN);
+		}
+	},
+	.user_ctx = nullptr
+};
+
 httpd_handle_t setup_server(void)
 {
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+	config.max_uri_handlers = 16;
 	httpd_handle_t server = nullptr;
 
 	if (httpd_start(&server, &config) == ESP_OK) {
@@ -475,40 +1587,163 @@ httpd_handle_t setup_server(void)
 		httpd_register_uri_handler(server, &list_handler);
 		httpd_register_uri_handler(server, &play_handler);
 		httpd_register_uri_handler(server, &stop_handler);
+		httpd_register_uri_handler(server, &seek_handler);
+		httpd_register_uri_handler(server, &stream_handler);
 		httpd_register_uri_handler(server, &volume_handler);
 		httpd_register_uri_handler(server, &mode_handler);
 		httpd_register_uri_handler(server, &state_handler);
+		httpd_register_uri_handler(server, &events_handler);
+		httpd_register_uri_handler(server, &stats_handler);
+		httpd_register_uri_handler(server, &metrics_handler);
+		httpd_register_uri_handler(server, &clock_handler);
+		httpd_register_uri_handler(server, &library_handler);
 	}
 
 	return server;
 }
 
 
+/**
+* @brief Cycle counts (CCOUNT) of the per-sample DAC output: the bit-by-bit encoder the ISR ran
+*        before, against the lookup table one it runs now, along with the task side encoding the
+*        latter moved out of the ISR. The minimum over the samples leaves the interrupts out.
+*/
+void benchmark_isr()
+{
+	dac_gpio gpio{player_config};
+	reference_dac_gpio reference{player_config};
+
+	struct cycle_count {
+		uint32_t min{UINT32_MAX};
+		uint64_t total{0};
+
+		void record(uint32_t cycles)
+		{
+			min = std::min(min, cycles);
+			total += cycles;
+		}
+	} old_isr{}, new_isr{}, new_encode{};
+
+	for (size_t i = 0; i < isr_benchmark_samples; ++i) {
+		auto ch1_val = (int16_t)(i * 40503), ch2_val = (int16_t)~(i * 40503);
+
+		auto start = esp_cpu_get_cycle_count();
+		reference.set_samples_and_enable(ch1_val, ch2_val);
+		old_isr.record(esp_cpu_get_cycle_count() - start);
+
+		start = esp_cpu_get_cycle_count();
+		auto value = pcm56_encoding::encode(ch1_val, ch2_val);
+		new_encode.record(esp_cpu_get_cycle_count() - start);
+
+		start = esp_cpu_get_cycle_count();
+		gpio.set_sample_and_enable(value);
+		new_isr.record(esp_cpu_get_cycle_count() - start);
+	}
+
+	printf("isr benchmark: cycles/sample, min/mean over %zu samples: bit-by-bit ISR %" PRIu32 "/%" PRIu64 ", "
+			"lookup table ISR %" PRIu32 "/%" PRIu64 " + task side encoding %" PRIu32 "/%" PRIu64 "\n",
+			isr_benchmark_samples,
+			old_isr.min, old_isr.total / isr_benchmark_samples,
+			new_isr.min, new_isr.total / isr_benchmark_samples,
+			new_encode.min, new_encode.total / isr_benchmark_samples);
+}
+
+
+/**
+* @brief Cycle counts (CCOUNT) of the sample rate conversion to player_sample_rate, per stereo output
+*        sample, and the share of a core it takes at that rate, for each source rate and bit size.
+*        The counts take in the interrupts of the core it runs on.
+*/
+void benchmark_resampler()
+{
+	static flac_sample_type source[2][resampler_benchmark_block_size];
+	const flac_sample_type *channels[] = {source[0], source[1]};
+
+	printf("resampler benchmark: %zu taps (before decimation), %zu phases; cycles/output sample, %% of a %d MHz core\n",
+			resampler_type::tap_count, resampler_type::phase_count, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+	for (uint8_t sample_bit_size : {16, 24}) {
+		for (size_t i = 0; i < resampler_benchmark_block_size; ++i) {
+			source[0][i] = (flac_sample_type)((i * 40503) & ((1u << sample_bit_size) - 1)) - (1 << (sample_bit_size - 1));
+			source[1][i] = ~source[0][i];
+		}
+		for (uint32_t input_rate : {32000, 48000, 88200, 96000}) {
+			resampler.configure(input_rate, player_sample_rate, 2, sample_bit_size);
+			uint64_t cycles = 0;
+			size_t output_total = 0;
+			for (size_t block = 0; block < resampler_benchmark_blocks; ++block) {
+				size_t input_pos = 0;
+				auto count = resampler.output_count(resampler_benchmark_block_size);
+				auto start = esp_cpu_get_cycle_count();
+				for (size_t done = 0; done < count; ) {
+					auto chunk = std::min(count - done, resampler.chunk_size);
+					resampler.run(channels, input_pos, chunk);
+					done += chunk;
+				}
+				resampler.absorb(channels, input_pos, resampler_benchmark_block_size);
+				cycles += esp_cpu_get_cycle_count() - start;
+				output_total += count;
+			}
+			auto per_sample = (double)cycles / output_total;
+			printf("  %" PRIu32 " Hz %" PRIu8 " bit, %zu taps: %.0f cycles, %.1f%%\n", input_rate, sample_bit_size,
+					resampler.taps(), per_sample, per_sample * player_sample_rate / (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1e4));
+		}
+	}
+	resampler.reset();
+}
+
+
 void player_main()
 {
+	player_task = xTaskGetCurrentTaskHandle();
+	start_decoder();
+	read_ahead_type read_ahead{sd_stats, read_ahead_core, read_ahead_priority};
+	album_index.invalidate();  // a new card, or the same one, possibly rewritten
+	streaminfo_cache.clear();
 	state = state_type::ready;
 
+	// between sessions this task consumes the commands; a play or seek one may also end a session
+	auto command = std::optional<player_command>{};
+	auto request = player_command{};
 	for (;;) {
 		if (!card_detect.card_present()) {
 			std::cout << "player: SD card removed!" << std::endl;
+			library_scanner.stop();  // before the unmount
 
 			break;
 		}
 
-		if (state == state_type::ready) {
-			if (cmd == cmd_type::play) {
-				cmd = cmd_type::idle;
-
+		if (!command)
+			command = commands.pop();
+		if (command) {
+			if (command->type == cmd_type::play) {
+				set_play_path(command->path);
+				request = std::move(*command);
+				state = state_type::play;
+				std::cout << "player: cmd=play" << std::endl;
+			} else if (command->type == cmd_type::stream) {
+				set_stream_path(command->path, (uint16_t)command->value);
+				request = std::move(*command);
 				state = state_type::play;
+				std::cout << "player: cmd=stream" << std::endl;
+			} else if (command->type == cmd_type::seek) {
+				if ((state == state_type::play) && (request.type != cmd_type::stream))
+					request = std::move(*command);  // within play_path, from where the session left it
+			} else if (command->type == cmd_type::stop) {
+				latency_of(cmd_type::stop).record(esp_timer_get_time() - command->time_us);  // nothing playing
+			} else {
+				apply_setting(*command);
 			}
+			command.reset();
 		}
 
 		if (state == state_type::play) {
 			relays.set(true);
 
 			try {
-				play_track();
+				command = play_session(read_ahead, request);
 			} catch (basics::error& e) {
+				read_ahead.close();
+
 				e.append("player failure");
 				e.dump();
 
@@ -516,6 +1751,8 @@ void player_main()
 
 				vTaskDelay(1000 / portTICK_PERIOD_MS);
 			} catch (const std::exception &e) {
+				read_ahead.close();
+				library_scanner.stop();
 				std::cerr << "player failure: " << e.what() << std::endl;
 				throw;
 			}
@@ -524,7 +1761,8 @@ void player_main()
 		if (state != state_type::play)
 			relays.set(false);
 
-		vTaskDelay(25 / portTICK_PERIOD_MS);
+		if (!command && commands.empty())
+			ulTaskNotifyTake(pdTRUE, 25 / portTICK_PERIOD_MS);
 	}
 }
 
@@ -565,6 +1803,8 @@ void user_main()
 
 // wifi task   -> core 1 : menuconfig → Component config → Wi-Fi
 // tcp/ip task -> core 1 : menuconfig → Component config → LWIP
+// decoder task -> core 1 : decoder_task_core
+// read ahead, net stream -> core 0 : read_ahead_core, net_stream_core
 // main task   -> core 0 : menuconfig → Component config → ESP System Settings → Main task core affinity
 // interrupt watchdog on : menuconfig → Component config → ESP System Settings → [-] Interrupt watchdog
 // task watchdog timer on: menuconfig → Component config → ESP System Settings → [-] Enable Task Watchdog Timer
@@ -574,14 +1814,20 @@ void user_main()
 // CPU freq. -> 240MHz   : menuconfig → Component Config → ESP System settings → CPU frequency (changed from 160MHz to 240MHz)
 extern "C" void app_main(void)
 {
+	if constexpr (isr_benchmark)
+		benchmark_isr();
+	if constexpr (resampler_benchmark)
+		benchmark_resampler();
+
 	for (;;) {
 		try {
 			state = state_type::init;
 			play_mode = play_mode_type::album;
 
 			esp::storage::nvs_partition nvs{};
+			clock_trim_ppm = load_clock_trim();
 			esp::io::wifi_sta wifi{wifi_ssid, wifi_pasw};
-			setup_server();
+			start_state_push(setup_server());
 
 			std::cout << "app: networking ready" << std::endl;
 
@@ -0,0 +1,190 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <random>
+#include <iostream>
+#include <player.hh>
+#include <sample_convert.hh>
+#include <stream_buffer.hh>
+
+/**
+* @name convert_bench
+*
+* @brief Host tool: times the decoded block to player buffer copy, the per-sample loop play_track
+*        had (a put() per sample, a bit shift for volume) against the block_conversion kernels
+*        writing in place through put_block(), at a constant gain and with a gain ramp across each
+*        block, and reports their time as a share of the shift loop's, the budget they replaced.
+*        Checks that the kernels at 0dB give the shift loop's output.
+*
+*   convert_bench [seconds per case]    default 0.5
+*
+* Reports ns and host cycles (TSC) per stereo sample: the ratios carry over to the target better
+* than the figures themselves do.
+*/
+
+
+using source_type = int32_t;  // FLAC decoder samples, as main's flac_sample_type
+using bench_buffer_type = stream_buffer<encoded_sample_type, 512, 8>;
+
+static const size_t bench_block_size = 4096;
+
+
+struct bench_source {
+	uint8_t sample_bit_size;
+	uint8_t channel_count;
+	std::vector<source_type> data[2];
+	const source_type *channels[2];
+
+	bench_source(uint8_t sample_bit_size, uint8_t channel_count)
+		: sample_bit_size{sample_bit_size}, channel_count{channel_count}, data{}, channels{}
+	{
+		std::mt19937 random{1};
+		std::uniform_int_distribution<source_type> value{-(1 << (sample_bit_size - 1)), (1 << (sample_bit_size - 1)) - 1};
+		for (uint8_t c = 0; c < 2; ++c) {
+			data[c].resize(bench_block_size);
+			for (auto &sample : data[c])
+				sample = value(random);
+			channels[c] = data[(c < channel_count)? c : 0].data();
+		}
+	}
+};
+
+
+// the loop play_track had, three of them by the sign of the shift
+void shift_loop(bench_buffer_type &buffer, const bench_source &source, int rshift)
+{
+	const auto *ch0 = source.channels[0];
+	const auto *ch1 = source.channels[1];
+	if (rshift == 0) {
+		for (auto i = size_t{0}; i < bench_block_size; ++i)
+			buffer.template put<task_operation>(pcm56_encoding::encode(
+				(player_sample_type)ch0[i], (player_sample_type)ch1[i]));
+	} else if (rshift >= 0) {
+		for (auto i = size_t{0}; i < bench_block_size; ++i)
+			buffer.template put<task_operation>(pcm56_encoding::encode(
+				(player_sample_type)(ch0[i] >> rshift), (player_sample_type)(ch1[i] >> rshift)));
+	} else { // (rshift < 0)
+		for (auto i = size_t{0}; i < bench_block_size; ++i)
+			buffer.template put<task_operation>(pcm56_encoding::encode(
+				(player_sample_type)(ch0[i] << -rshift), (player_sample_type)(ch1[i] << -rshift)));
+	}
+}
+
+
+void kernel_block(bench_buffer_type &buffer, const bench_source &source, int32_t from_gain, int32_t to_gain)
+{
+	block_conversion<source_type> conversion{source.channel_count, source.sample_bit_size, from_gain, to_gain,
+												bench_block_size};
+	size_t offset = 0;
+	buffer.put_block(bench_block_size, [&](encoded_sample_type *data, size_t count) {
+		conversion(source.channels, offset, data, count);
+		offset += count;
+	});
+}
+
+
+// returns the host cycles per sample
+template<typename BLOCK>
+double bench(const char *name, double seconds, BLOCK &&block)
+{
+	auto buffer = std::make_unique<bench_buffer_type>();
+	size_t sample_count = 0;
+	uint64_t cycles = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = std::chrono::duration<double>{0};
+	do {
+		// at a slot offset, so that the writes wrap around the ring
+		buffer->reset();
+		buffer->put_span(std::vector<encoded_sample_type>(512 * (sample_count / bench_block_size % 8)));
+		buffer->consume(buffer->size());
+
+		auto cycle_start = esp_cpu_get_cycle_count();
+		block(*buffer);
+		cycles += (uint32_t)(esp_cpu_get_cycle_count() - cycle_start);
+		sample_count += bench_block_size;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < seconds);
+
+	printf("  %-34s %6.2f ns/sample %7.2f cycles/sample\n", name, elapsed.count() * 1e9 / sample_count,
+			(double)cycles / sample_count);
+
+	return (double)cycles / sample_count;
+}
+
+
+// the shift loop and the 0dB kernel give the same words
+bool check(const bench_source &source, int rshift)
+{
+	auto expected = std::make_unique<bench_buffer_type>();
+	auto converted = std::make_unique<bench_buffer_type>();
+	shift_loop(*expected, source, rshift);
+	kernel_block(*converted, source, volume_gain(0), volume_gain(0));
+
+	return std::equal(expected->peek().begin(), expected->peek().end(), converted->peek().begin(),
+						converted->peek().end());
+}
+
+
+int main(int argc, char *argv[])
+{
+	double seconds = (argc > 1)? std::stod(argv[1]) : 0.5;
+	bool identical = true;
+
+	for (auto [bits, channels] : {std::pair<uint8_t, uint8_t>{16, 2}, {24, 2}, {16, 1}}) {
+		bench_source source{bits, channels};
+		int rshift = bits - player_sample_bit_size;
+		printf("%u bit %s, %zu sample blocks:\n", bits, (channels == 1)? "mono" : "stereo", bench_block_size);
+
+		auto shift = 0.0, shift_cut = 0.0;
+		if (channels == 2) {
+			shift = bench("per-sample put(), shift", seconds, [&](auto &buffer) { shift_loop(buffer, source, rshift); });
+			shift_cut = bench("per-sample put(), shift -6dB", seconds, [&](auto &buffer) {
+				shift_loop(buffer, source, rshift + 1);
+			});
+			identical = identical && check(source, rshift);
+		}
+		auto unity = bench("put_block(), kernel 0dB", seconds, [&](auto &buffer) {
+			kernel_block(buffer, source, volume_gain(0), volume_gain(0));
+		});
+		auto cut = bench("put_block(), kernel -6.5dB", seconds, [&](auto &buffer) {
+			kernel_block(buffer, source, volume_gain(-13), volume_gain(-13));
+		});
+		auto ramp = bench("put_block(), kernel ramp -20..0dB", seconds, [&](auto &buffer) {
+			kernel_block(buffer, source, volume_gain(-40), volume_gain(0));
+		});
+		bench("put_block(), kernel +6dB", seconds, [&](auto &buffer) {
+			kernel_block(buffer, source, volume_gain(12), volume_gain(12));
+		});
+
+		// the budget: what the shift loop took for the same block, at 0dB and at a cut
+		if (channels == 2)
+			printf("  of the shift loop's time: %.0f%% at 0dB, %.0f%% at -6.5dB, %.0f%% ramping\n",
+					100 * unity / shift, 100 * cut / shift_cut, 100 * ramp / shift_cut);
+	}
+
+	printf("0dB kernels against the shift loop: %s\n", identical? "identical" : "DIFFERENT");
+	if (!identical) {
+		std::cerr << "error: the kernels at 0dB do not give the shift loop's output" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
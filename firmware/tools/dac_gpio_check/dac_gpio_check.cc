@@ -0,0 +1,162 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <player.hh>
+#include <dac_gpio_reference.hh>
+#include <dma_player.hh>
+
+/**
+* @name dac_gpio_check
+*
+* @brief Host tool: checks that dac_gpio, encoding the samples ahead with pcm56_encoding and
+*        writing them out through its lookup tables, makes exactly the GPIO register writes of the
+*        bit-by-bit encoder it replaced (reference_dac_gpio), for every 16 bit value on either channel.
+*        Then that the DMA frames of pcm56_bitstream, as the ESP32 I2S shifts them out, drive the
+*        pins through the same states as those writes.
+*
+*   dac_gpio_check
+*
+* The frames are built for the ESP32 (CONFIG_IDF_TARGET_ESP32), with their bytes swapped within
+* each 16 bit half-word, and read back in the order the peripheral sends them. Both sides are
+* compared as the sequences of distinct pin states they go through: the transient state between
+* the W1TC and W1TS writes of a bit carries no CLK edge, and a state held for a number of bus words
+* is the same state.
+*/
+
+
+static const auto check_config = stereo_player_config {
+	.clk_gpio      = 14,
+	.ch1_data_gpio = 26,
+	.ch2_data_gpio = 25,
+	.le_gpio       = 27
+};
+
+
+using reg_writes = std::vector<std::pair<uint32_t, uint32_t>>;
+
+// CLK, DATA1, DATA2 and LE, as the bits of a bitstream word
+using pin_states = std::vector<pcm56_bitstream::word_type>;
+
+
+// the pin states of the register writes, from the state before them
+pin_states gpio_states(const reg_writes &writes, uint32_t &out)
+{
+	auto state = [&out] {
+		return (pcm56_bitstream::word_type)(((out & (1u << check_config.clk_gpio))? pcm56_bitstream::clk : 0)
+				| ((out & (1u << check_config.ch1_data_gpio))? pcm56_bitstream::data1 : 0)
+				| ((out & (1u << check_config.ch2_data_gpio))? pcm56_bitstream::data2 : 0)
+				| ((out & (1u << check_config.le_gpio))? pcm56_bitstream::le : 0));
+	};
+
+	pin_states states{state()};
+	for (size_t i = 0; i < writes.size(); ++i) {
+		auto [reg, value] = writes[i];
+		if (reg == GPIO_OUT_W1TS_REG)
+			out |= value;
+		else if (reg == GPIO_OUT_W1TC_REG)
+			out &= ~value;
+
+		// a W1TC followed by a W1TS sets the data lines of a bit in two steps
+		auto transient = (reg == GPIO_OUT_W1TC_REG) && (i + 1 < writes.size()) && (writes[i + 1].first == GPIO_OUT_W1TS_REG);
+		if (!transient && (state() != states.back()))
+			states.push_back(state());
+	}
+
+	return states;
+}
+
+
+// the pin states of the frame, sent word by word with the bytes of each half-word swapped, from
+// the last state of the previous one
+pin_states dma_states(const pcm56_bitstream::word_type (&frame)[pcm56_bitstream::frame_size], pcm56_bitstream::word_type last)
+{
+	pin_states states{last};
+	for (size_t pos = 0; pos < pcm56_bitstream::frame_size; ++pos) {
+		auto word = frame[pos ^ 1];
+		if (word != states.back())
+			states.push_back(word);
+	}
+
+	return states;
+}
+
+
+int main()
+{
+	reg_writes writes{};
+	host_stubs::reg_write_hook = [&writes](uint32_t reg, uint32_t value) { writes.emplace_back(reg, value); };
+
+	dac_gpio dac{check_config};
+	reference_dac_gpio reference{check_config};
+
+	size_t sample_count = 0, mismatch_count = 0, frame_mismatch_count = 0;
+	auto out = uint32_t{0};
+	auto bus = pcm56_bitstream::word_type{0};
+	auto check = [&](int16_t ch1_val, int16_t ch2_val) {
+		auto value = pcm56_encoding::encode(ch1_val, ch2_val);
+		writes.clear();
+		dac.set_sample_and_enable(value);
+		auto encoded = writes;
+
+		pcm56_bitstream::word_type frame[pcm56_bitstream::frame_size];
+		pcm56_bitstream::encode(value, frame);
+		auto expected = gpio_states(encoded, out);
+		auto sent = dma_states(frame, bus);
+		bus = frame[(pcm56_bitstream::frame_size - 1) ^ 1];
+		if (sent != expected) {
+			if (frame_mismatch_count++ < 8)
+				printf("frame mismatch: %d/%d, %zu vs. %zu pin states\n", ch1_val, ch2_val, sent.size(), expected.size());
+		}
+
+		writes.clear();
+		reference.set_samples_and_enable(ch1_val, ch2_val);
+
+		++sample_count;
+		if (encoded != writes) {
+			if (mismatch_count++ < 8)
+				printf("mismatch: %d/%d, %zu vs. %zu writes\n", ch1_val, ch2_val, encoded.size(), writes.size());
+		}
+	};
+
+	// every value on each channel, against its complement, itself, zero and a scrambled value
+	for (uint32_t value = 0; value < 65536; ++value) {
+		auto scrambled = (int16_t)(value * 40503u >> 3);
+		check((int16_t)value, (int16_t)~value);
+		check((int16_t)value, (int16_t)value);
+		check((int16_t)value, 0);
+		check(0, (int16_t)value);
+		check((int16_t)value, scrambled);
+		check(scrambled, (int16_t)value);
+	}
+	host_stubs::reg_write_hook = nullptr;
+
+	printf("%zu samples, %zu mismatches, %zu DMA frame mismatches\n", sample_count, mismatch_count, frame_mismatch_count);
+	if (mismatch_count != 0) {
+		std::cerr << "error: dac_gpio does not write what the bit-by-bit encoder did" << std::endl;
+		return 1;
+	}
+	if (frame_mismatch_count != 0) {
+		std::cerr << "error: the DMA frames do not drive the pins as dac_gpio does" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <streambuf>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <audio/flac.hh>
+#include "md5.hh"
+
+/**
+* @name flac_bench
+*
+* @brief Host tool: decodes a corpus of FLAC files with the player's decoder, checks the output
+*        against the MD5 signature of each STREAMINFO, and reports the decoding throughput; fails on
+*        a signature mismatch, and on a throughput regression against the baseline.
+*
+*   flac_bench <corpus dir> [--runs <n>] [--baseline <file>] [--tolerance <fraction>] [--update]
+*
+* The baseline, <corpus dir>/baseline.txt by default, holds the samples/second of each file, and
+* --update writes it from the run; throughput being machine specific, it stays with the corpus.
+* make_corpus.py builds a corpus with the reference encoder.
+*/
+
+
+namespace fs = std::filesystem;
+
+static const uint16_t block_max_size = 4608;  // the firmware's
+static const size_t default_runs = 3;
+static const double default_tolerance = 0.1;
+
+using decoder_type = audio::flac::decoder<std::istream, block_max_size>;
+
+
+// read only stream over the file content, with no copy
+class memory_buffer : public std::streambuf {
+public:
+	explicit memory_buffer(const std::string &data)
+	{
+		auto *begin = const_cast<char *>(data.data());
+		setg(begin, begin, begin + data.size());
+	}
+};
+
+
+struct result_type {
+	std::string name;
+	audio::flac::streaminfo_type info;
+	double seconds;      // of the fastest run
+	uint64_t cycles;     // of the fastest run, 0 when unknown
+	bool has_signature;  // the encoder stored one
+	bool match;
+};
+
+
+// timestamp counter cycles, at the nominal clock
+uint64_t cycle_count()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+
+// the MD5 of the audio, as stored in STREAMINFO, always the first metadata block
+md5_hash::digest_type stored_signature(const std::string &data)
+{
+	md5_hash::digest_type res{};
+	if ((data.size() >= 8 + 34) && (data.compare(0, 4, "fLaC") == 0))
+		memcpy(res.data(), data.data() + 8 + 18, res.size());
+
+	return res;
+}
+
+
+// decodes the whole stream, hashing the output when given a hash: interleaved, little endian
+// samples of whole bytes, as the signature is defined
+audio::flac::streaminfo_type decode(const std::string &data, md5_hash *hash)
+{
+	memory_buffer buffer{data};
+	std::istream input{&buffer};
+	decoder_type decoder{input};
+
+	decoder.decode_marker();
+	while (decoder.state() != audio::flac::decoder_state::has_metadata)
+		decoder.decode_metadata();
+	auto info = decoder.streaminfo();
+	if (info.max_block_size > block_max_size)
+		throw std::runtime_error("block size beyond the player's");
+
+	auto sample_size = (size_t)(info.sample_bit_size + 7) / 8;
+	std::vector<uint8_t> bytes(block_max_size * info.channel_count * sample_size);
+	for (;;) {
+		decoder.decode_audio();
+		if (hash != nullptr) {
+			auto *out = bytes.data();
+			for (size_t i = 0; i < decoder.block_size(); ++i) {
+				for (uint8_t c = 0; c < info.channel_count; ++c) {
+					auto sample = (int32_t)decoder.block_data()[c][i];
+					for (size_t b = 0; b < sample_size; ++b)
+						*out++ = (uint8_t)(sample >> (8 * b));
+				}
+			}
+			hash->update(bytes.data(), out - bytes.data());
+		}
+
+		if (decoder.state() == audio::flac::decoder_state::complete)
+			break;
+	}
+
+	return info;
+}
+
+
+result_type run(const fs::path &path, size_t runs)
+{
+	std::ifstream file{path, std::ios::binary};
+	auto data = std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+
+	// a checked pass, then the timed ones
+	auto res = result_type{path.filename().string(), {}, 0, 0, false, false};
+	md5_hash hash{};
+	res.info = decode(data, &hash);
+	auto stored = stored_signature(data);
+	res.has_signature = (stored != md5_hash::digest_type{});
+	res.match = (hash.finish() == stored);
+
+	for (size_t i = 0; i < runs; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		auto start_cycles = cycle_count();
+		decode(data, nullptr);
+		auto cycles = cycle_count() - start_cycles;
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if ((i == 0) || (seconds < res.seconds)) {
+			res.seconds = seconds;
+			res.cycles = cycles;
+		}
+	}
+
+	return res;
+}
+
+
+std::map<std::string, double> read_baseline(const fs::path &path)
+{
+	std::map<std::string, double> res{};
+	std::ifstream file{path};
+	std::string name{};
+	double rate = 0;
+	while (file >> name >> rate)
+		res[name] = rate;
+
+	return res;
+}
+
+
+int bench(const fs::path &corpus, size_t runs, const fs::path &baseline_path, double tolerance, bool update)
+{
+	std::vector<fs::path> paths{};
+	for (const auto &entry : fs::directory_iterator{corpus}) {
+		auto extension = entry.path().extension().string();
+		if (entry.is_regular_file() && (extension.size() == 5) && (strncasecmp(extension.c_str(), ".flac", 5) == 0))
+			paths.push_back(entry.path());
+	}
+	std::sort(paths.begin(), paths.end());
+	if (paths.empty()) {
+		std::cerr << "no FLAC files in " << corpus.string() << std::endl;
+		return 2;
+	}
+
+	auto baseline = read_baseline(baseline_path);
+	auto failures = size_t{0};
+	std::vector<result_type> results{};
+	printf("%-40s %6s %3s %2s %5s %10s %12s %8s %10s  %s\n", "file", "rate", "bit", "ch", "block", "samples",
+			"samples/s", "x real", "cycles/s.", "check");
+	for (const auto &path : paths) {
+		try {
+			auto res = run(path, runs);
+			auto rate = res.info.sample_count / res.seconds;
+			std::string check = !res.has_signature? "unsigned" : res.match? "md5 ok" : "MD5 MISMATCH";
+			if (res.has_signature && !res.match)
+				++failures;
+
+			auto base = baseline.find(res.name);
+			if (!update && (base != baseline.end())) {
+				auto change = rate / base->second - 1;
+				char text[32];
+				snprintf(text, sizeof(text), ", %+.1f%%", change * 100);
+				check += text;
+				if (change < -tolerance) {
+					check += " REGRESSION";
+					++failures;
+				}
+			}
+
+			printf("%-40s %6u %3u %2u %5u %10llu %12.0f %8.1f %10.1f  %s\n", res.name.c_str(),
+					(unsigned)res.info.sample_rate, (unsigned)res.info.sample_bit_size,
+					(unsigned)res.info.channel_count, (unsigned)res.info.max_block_size,
+					(unsigned long long)res.info.sample_count, rate, rate / res.info.sample_rate,
+					res.info.sample_count? (double)res.cycles / res.info.sample_count : 0.0, check.c_str());
+			results.push_back(std::move(res));
+		} catch (basics::error &e) {
+			e.append(path.filename().string().c_str());
+			e.dump();
+			++failures;
+		} catch (const std::exception &e) {
+			std::cerr << "error: " << path.filename().string() << ": " << e.what() << std::endl;
+			++failures;
+		}
+	}
+
+	if (update) {
+		if (failures != 0) {
+			std::cerr << "baseline not updated: " << failures << " failures" << std::endl;
+			return 1;
+		}
+
+		std::ofstream file{baseline_path};
+		for (const auto &res : results)
+			file << res.name << " " << (uint64_t)(res.info.sample_count / res.seconds) << "\n";
+		std::cout << "baseline written to " << baseline_path.string() << std::endl;
+	}
+	std::cout << results.size() << " files, " << failures << " failures" << std::endl;
+
+	return (failures == 0)? 0 : 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	try {
+		if (argc >= 2) {
+			auto corpus = fs::path{argv[1]};
+			auto runs = default_runs;
+			auto baseline = corpus / "baseline.txt";
+			auto tolerance = default_tolerance;
+			auto update = false;
+			auto i = 2;
+			for (; i < argc; ++i) {
+				auto arg = std::string{argv[i]};
+				if ((arg == "--runs") && (i + 1 < argc))
+					runs = std::max(1ul, std::stoul(argv[++i]));
+				else if ((arg == "--baseline") && (i + 1 < argc))
+					baseline = argv[++i];
+				else if ((arg == "--tolerance") && (i + 1 < argc))
+					tolerance = std::stod(argv[++i]);
+				else if (arg == "--update")
+					update = true;
+				else
+					break;
+			}
+			if (i == argc)
+				return bench(corpus, runs, baseline, tolerance, update);
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cerr << "usage: " << argv[0] << " <corpus dir> [--runs <n>] [--baseline <file>] [--tolerance <fraction>]"
+				<< " [--update]" << std::endl;
+	return 2;
+}
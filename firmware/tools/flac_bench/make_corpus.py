@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+#
+# esp32-audio-player - yet another esp32 audio player
+#
+# This library is free software: you can redistribute it and/or modify it under the terms of the
+# GNU General Public License as published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with this program.
+# If not, see <https://www.gnu.org/licenses/>.
+
+"""Host tool: builds the flac_bench corpus with the reference encoder (flac, on the PATH).
+
+The signal is the same for every file, a few drifting partials with some noise, correlated across
+the channels so that the stereo modes differ; the files vary by the stream parameters and the
+encoder settings: block sizes, bit depths, LPC orders, fixed predictors, stereo decorrelation.
+
+  make_corpus.py <corpus dir> [--seconds 10]
+"""
+
+import argparse
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import wave
+
+# name, sample rate, bits, channels, encoder options
+CORPUS = [
+    ("16bit_44k_b4096_lpc8_ms", 44100, 16, 2, ["-b", "4096", "-l", "8", "-m"]),
+    ("16bit_44k_b4608_lpc12_ms", 44100, 16, 2, ["-b", "4608", "-l", "12", "-m"]),
+    ("16bit_44k_b1152_lpc8_indep", 44100, 16, 2, ["-b", "1152", "-l", "8"]),
+    ("16bit_44k_b4096_fixed_ms", 44100, 16, 2, ["-b", "4096", "-l", "0", "-m"]),
+    ("16bit_44k_b4096_lpc32_exh", 44100, 16, 2, ["-b", "4096", "-l", "32", "-m", "-e", "-r", "8"]),
+    ("16bit_44k_b576_lpc4_adapt", 44100, 16, 2, ["-b", "576", "-l", "4", "-M"]),
+    ("16bit_44k_mono_b4096_lpc8", 44100, 16, 1, ["-b", "4096", "-l", "8"]),
+    ("8bit_22k_b2048_lpc8_ms", 22050, 8, 2, ["-b", "2048", "-l", "8", "-m"]),
+    ("24bit_48k_b4096_lpc12_ms", 48000, 24, 2, ["-b", "4096", "-l", "12", "-m"]),
+    ("24bit_96k_b4096_lpc8_ms", 96000, 24, 2, ["-b", "4096", "-l", "8", "-m"]),
+    ("24bit_96k_b4608_lpc12_adapt", 96000, 24, 2, ["-b", "4608", "-l", "12", "-M"]),
+    ("24bit_96k_b4608_lpc32_indep", 96000, 24, 2, ["-b", "4608", "-l", "32", "-e"]),
+]
+
+
+def write_wav(path, rate, bits, channels, seconds):
+    rng = random.Random(1)
+    peak = (1 << (bits - 1)) - 1
+    partials = [(220.0, 0.3), (331.0, 0.2), (1250.0, 0.1), (5100.0, 0.05)]
+    frames = bytearray()
+    for i in range(int(rate * seconds)):
+        t = i / rate
+        tone = sum(level * math.sin(2 * math.pi * freq * (1 + 0.01 * math.sin(0.5 * t)) * t)
+                   for freq, level in partials)
+        for c in range(channels):
+            value = tone * (1 - 0.2 * c) + 0.01 * rng.uniform(-1, 1)
+            sample = max(-peak - 1, min(peak, int(value * peak)))
+            if bits == 8:
+                frames.append(sample + 128)  # unsigned in WAVE
+            else:
+                frames += sample.to_bytes(bits // 8, "little", signed=True)
+
+    with wave.open(path, "wb") as file:
+        file.setnchannels(channels)
+        file.setsampwidth(bits // 8)
+        file.setframerate(rate)
+        file.writeframes(bytes(frames))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("corpus")
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    os.makedirs(args.corpus, exist_ok=True)
+    sources = {}
+    with tempfile.TemporaryDirectory() as temp:
+        for name, rate, bits, channels, options in CORPUS:
+            source = sources.get((rate, bits, channels))
+            if source is None:
+                source = os.path.join(temp, f"{rate}_{bits}_{channels}.wav")
+                write_wav(source, rate, bits, channels, args.seconds)
+                sources[(rate, bits, channels)] = source
+
+            target = os.path.join(args.corpus, name + ".flac")
+            subprocess.run(["flac", "--silent", "--force", *options, "-o", target, source], check=True)
+            print(target)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except (subprocess.CalledProcessError, FileNotFoundError) as e:
+        sys.exit(f"error: {e}")
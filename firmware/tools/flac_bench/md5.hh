@@ -0,0 +1,134 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLAC_BENCH_MD5
+#define FLAC_BENCH_MD5
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+
+/**
+* @name md5
+*
+* @brief MD5 (RFC 1321), for the audio signature FLAC keeps in its STREAMINFO.
+*/
+
+
+class md5_hash {
+public:
+	using digest_type = std::array<uint8_t, 16>;
+
+	md5_hash()
+		: _state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476}, _size{0}, _buffer{}
+	{}
+
+	void update(const uint8_t *data, size_t size)
+	{
+		auto pos = (size_t)(_size % 64);
+		_size += size;
+		if (pos != 0) {
+			auto count = std::min(size, 64 - pos);
+			memcpy(_buffer + pos, data, count);
+			data += count;
+			size -= count;
+			if (pos + count < 64)
+				return;
+			_transform(_buffer);
+		}
+		for (; size >= 64; data += 64, size -= 64)
+			_transform(data);
+		memcpy(_buffer, data, size);
+	}
+
+	digest_type finish()
+	{
+		uint8_t tail[72] = {0x80};
+		auto bits = _size * 8;
+		auto pad = (size_t)((_size % 64 < 56)? 56 - _size % 64 : 120 - _size % 64);
+		for (size_t i = 0; i < 8; ++i)
+			tail[pad + i] = (uint8_t)(bits >> (8 * i));
+		update(tail, pad + 8);
+
+		digest_type digest{};
+		for (size_t i = 0; i < 16; ++i)
+			digest[i] = (uint8_t)(_state[i / 4] >> (8 * (i % 4)));
+
+		return digest;
+	}
+
+private:
+	uint32_t _state[4];
+	uint64_t _size;
+	uint8_t _buffer[64];
+
+	static uint32_t _rotate(uint32_t x, int count)
+	{
+		return (x << count) | (x >> (32 - count));
+	}
+
+	void _transform(const uint8_t *block)
+	{
+		static const uint32_t k[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+		static const int shifts[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+		uint32_t m[16];
+		for (size_t i = 0; i < 16; ++i)
+			m[i] = block[4 * i] | block[4 * i + 1] << 8 | block[4 * i + 2] << 16 | (uint32_t)block[4 * i + 3] << 24;
+
+		auto a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+		for (size_t i = 0; i < 64; ++i) {
+			auto round = i / 16;
+			uint32_t f = 0;
+			size_t g = 0;
+			if (round == 0) {
+				f = (b & c) | (~b & d);
+				g = i;
+			} else if (round == 1) {
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			} else if (round == 2) {
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			} else {
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+
+			auto next = b + _rotate(a + f + k[i] + m[g], shifts[round][i % 4]);
+			a = d;
+			d = c;
+			c = b;
+			b = next;
+		}
+		_state[0] += a;
+		_state[1] += b;
+		_state[2] += c;
+		_state[3] += d;
+	}
+};
+
+
+#endif // FLAC_BENCH_MD5
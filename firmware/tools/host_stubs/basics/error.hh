@@ -0,0 +1,58 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+
+namespace basics {
+
+// the printf formatted error of the basics library, its message given by what()
+class error : public std::runtime_error {
+public:
+	template<typename... ARGS>
+	explicit error(const char *format, ARGS... args)
+		: std::runtime_error{_format(format, args...)}
+	{}
+
+	void append(const char *context)
+	{
+		*this = error{"%s: %s", context, what()};
+	}
+
+	void dump() const
+	{
+		fprintf(stderr, "%s\n", what());
+	}
+
+private:
+	template<typename... ARGS>
+	static std::string _format(const char *format, ARGS... args)
+	{
+		if constexpr (sizeof...(ARGS) == 0) {
+			return format;
+		} else {
+			char message[256];
+			snprintf(message, sizeof(message), format, args...);
+
+			return message;
+		}
+	}
+};
+
+};  // namespace basics
@@ -0,0 +1,221 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include "esp_err.h"
+#include "host_stubs.hh"
+
+/**
+* @brief Simulated general purpose timers, counting on the virtual clock of host_stubs: their
+*        alarms fire, on the calling thread, as host_stubs::run_until() moves the clock past them.
+*/
+
+typedef struct gptimer_t *gptimer_handle_t;
+
+typedef enum { GPTIMER_CLK_SRC_DEFAULT } gptimer_clock_source_t;
+typedef enum { GPTIMER_COUNT_UP } gptimer_count_direction_t;
+
+typedef struct {
+	gptimer_clock_source_t clk_src;
+	gptimer_count_direction_t direction;
+	uint32_t resolution_hz;
+	int intr_priority;
+	struct {
+		uint32_t intr_shared: 1;
+	} flags;
+} gptimer_config_t;
+
+typedef struct {
+	uint64_t count_value;
+	uint64_t alarm_value;
+} gptimer_alarm_event_data_t;
+
+typedef bool (*gptimer_alarm_cb_t)(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx);
+
+typedef struct {
+	gptimer_alarm_cb_t on_alarm;
+} gptimer_event_callbacks_t;
+
+typedef struct {
+	uint64_t alarm_count;
+	uint64_t reload_count;
+	struct {
+		uint32_t auto_reload_on_alarm: 1;
+	} flags;
+} gptimer_alarm_config_t;
+
+
+struct gptimer_t {
+	uint32_t resolution_hz;
+	bool enabled;
+	bool running;
+	int64_t zero_ns;             // virtual time of count 0, while running
+	uint64_t stopped_count;      // the count, while stopped
+	bool alarm_set;
+	gptimer_alarm_config_t alarm;
+	gptimer_alarm_cb_t on_alarm;
+	void *user_ctx;
+
+	int64_t ns_of(uint64_t count) const
+	{
+		return (int64_t)(count / resolution_hz * 1000000000ull + count % resolution_hz * 1000000000ull / resolution_hz);
+	}
+
+	uint64_t count_at(int64_t ns) const
+	{
+		if (!running)
+			return stopped_count;
+
+		auto elapsed = (uint64_t)std::max<int64_t>(ns - zero_ns, 0);
+
+		return elapsed / 1000000000ull * resolution_hz + elapsed % 1000000000ull * resolution_hz / 1000000000ull;
+	}
+
+	int64_t alarm_ns() const
+	{
+		return zero_ns + ns_of(alarm.alarm_count);
+	}
+};
+
+
+namespace host_stubs {
+
+inline std::vector<gptimer_t *> &gptimers()
+{
+	static std::vector<gptimer_t *> timers{};
+
+	return timers;
+}
+
+
+inline void run_until(int64_t ns)
+{
+	for (;;) {
+		gptimer_t *next = nullptr;
+		auto at = ns;
+		for (auto *timer : gptimers()) {
+			if (!timer->running || !timer->alarm_set || (timer->on_alarm == nullptr))
+				continue;
+			if (timer->alarm_ns() <= at) {
+				at = timer->alarm_ns();
+				next = timer;
+			}
+		}
+		if (next == nullptr)
+			break;
+
+		// an alarm set in the past fires at once
+		now_ns = std::max(now_ns, at);
+		gptimer_alarm_event_data_t event{next->count_at(now_ns), next->alarm.alarm_count};
+		if (next->alarm.flags.auto_reload_on_alarm)
+			next->zero_ns = now_ns - next->ns_of(next->alarm.reload_count);
+		else
+			next->alarm_set = false;  // until the callback sets it anew
+		next->on_alarm(next, &event, next->user_ctx);
+	}
+	now_ns = std::max(now_ns, ns);
+}
+
+};  // namespace host_stubs
+
+
+inline esp_err_t gptimer_new_timer(const gptimer_config_t *config, gptimer_handle_t *ret_timer)
+{
+	auto *timer = new gptimer_t{config->resolution_hz, false, false, 0, 0, false, {}, nullptr, nullptr};
+	host_stubs::gptimers().push_back(timer);
+	*ret_timer = timer;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_del_timer(gptimer_handle_t timer)
+{
+	if (timer->enabled)
+		return ESP_ERR_INVALID_STATE;
+
+	auto &timers = host_stubs::gptimers();
+	timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+	delete timer;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t *cbs,
+													void *user_data)
+{
+	timer->on_alarm = cbs->on_alarm;
+	timer->user_ctx = user_data;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_enable(gptimer_handle_t timer)
+{
+	timer->enabled = true;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_disable(gptimer_handle_t timer)
+{
+	if (timer->running)
+		return ESP_ERR_INVALID_STATE;
+	timer->enabled = false;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_start(gptimer_handle_t timer)
+{
+	if (!timer->enabled || timer->running)
+		return ESP_ERR_INVALID_STATE;
+
+	timer->zero_ns = host_stubs::now_ns - timer->ns_of(timer->stopped_count);
+	timer->running = true;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_stop(gptimer_handle_t timer)
+{
+	if (!timer->running)
+		return ESP_ERR_INVALID_STATE;
+
+	timer->stopped_count = timer->count_at(host_stubs::now_ns);
+	timer->running = false;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t *config)
+{
+	timer->alarm_set = (config != nullptr);
+	if (config != nullptr)
+		timer->alarm = *config;
+
+	return ESP_OK;
+}
+
+inline esp_err_t gptimer_get_raw_count(gptimer_handle_t timer, uint64_t *value)
+{
+	*value = timer->count_at(host_stubs::now_ns);
+
+	return ESP_OK;
+}
@@ -0,0 +1,36 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+// the host's time stamp counter where there is one, else its clock in ns: host cycles, not the
+// ESP32's CCOUNT
+inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (esp_cpu_cycle_count_t)__rdtsc();
+#else
+	return (esp_cpu_cycle_count_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
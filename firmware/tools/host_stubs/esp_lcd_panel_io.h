@@ -0,0 +1,70 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+
+// the i80 bus types and calls, declared only: the host tools check the bitstream, not the bus
+
+typedef struct esp_lcd_i80_bus_t *esp_lcd_i80_bus_handle_t;
+typedef struct esp_lcd_panel_io_t *esp_lcd_panel_io_handle_t;
+
+typedef enum {
+	LCD_CLK_SRC_DEFAULT
+} lcd_clock_source_t;
+
+typedef struct {
+} esp_lcd_panel_io_event_data_t;
+
+typedef bool (*esp_lcd_panel_io_color_trans_done_cb_t)(esp_lcd_panel_io_handle_t panel_io,
+														esp_lcd_panel_io_event_data_t *edata, void *user_ctx);
+
+typedef struct {
+	int dc_gpio_num;
+	int wr_gpio_num;
+	lcd_clock_source_t clk_src;
+	int data_gpio_nums[24];
+	size_t bus_width;
+	size_t max_transfer_bytes;
+	size_t psram_trans_align;
+	size_t sram_trans_align;
+} esp_lcd_i80_bus_config_t;
+
+typedef struct {
+	int cs_gpio_num;
+	uint32_t pclk_hz;
+	size_t trans_queue_depth;
+	esp_lcd_panel_io_color_trans_done_cb_t on_color_trans_done;
+	void *user_ctx;
+	int lcd_cmd_bits;
+	int lcd_param_bits;
+	struct {
+		unsigned int dc_idle_level: 1;
+		unsigned int dc_cmd_level: 1;
+		unsigned int dc_dummy_level: 1;
+		unsigned int dc_data_level: 1;
+	} dc_levels;
+} esp_lcd_panel_io_i80_config_t;
+
+esp_err_t esp_lcd_new_i80_bus(const esp_lcd_i80_bus_config_t *bus_config, esp_lcd_i80_bus_handle_t *ret_bus);
+esp_err_t esp_lcd_del_i80_bus(esp_lcd_i80_bus_handle_t bus);
+esp_err_t esp_lcd_new_panel_io_i80(esp_lcd_i80_bus_handle_t bus, const esp_lcd_panel_io_i80_config_t *io_config,
+									esp_lcd_panel_io_handle_t *ret_io);
+esp_err_t esp_lcd_panel_io_del(esp_lcd_panel_io_handle_t io);
+esp_err_t esp_lcd_panel_io_tx_color(esp_lcd_panel_io_handle_t io, int lcd_cmd, const void *color, size_t color_size);
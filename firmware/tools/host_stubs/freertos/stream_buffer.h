@@ -0,0 +1,51 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "freertos/FreeRTOS.h"
+
+// the FreeRTOS stream buffer, declared for stream_buffer_rtos: none of the host tools use it
+typedef struct StreamBufferDef_t *StreamBufferHandle_t;
+
+inline StreamBufferHandle_t xStreamBufferCreate(size_t, size_t)
+{
+	return nullptr;
+}
+
+inline void vStreamBufferDelete(StreamBufferHandle_t)
+{}
+
+inline size_t xStreamBufferReceive(StreamBufferHandle_t, void *, size_t, TickType_t)
+{
+	return 0;
+}
+
+inline size_t xStreamBufferSend(StreamBufferHandle_t, const void *, size_t, TickType_t)
+{
+	return 0;
+}
+
+inline size_t xStreamBufferReceiveFromISR(StreamBufferHandle_t, void *, size_t, BaseType_t *)
+{
+	return 0;
+}
+
+inline size_t xStreamBufferSendFromISR(StreamBufferHandle_t, const void *, size_t, BaseType_t *)
+{
+	return 0;
+}
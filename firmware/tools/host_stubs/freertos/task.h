@@ -0,0 +1,98 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "freertos/FreeRTOS.h"
+
+/**
+* @brief Task notifications between host threads: each thread is a task, with its notification
+*        count. Ticks are ms.
+*/
+
+struct tskTaskControlBlock {
+	std::mutex lock;
+	std::condition_variable changed;
+	uint32_t notification_count;
+};
+
+typedef tskTaskControlBlock *TaskHandle_t;
+
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+	thread_local tskTaskControlBlock task{{}, {}, 0};
+
+	return &task;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	{
+		std::lock_guard<std::mutex> guard{task->lock};
+		++task->notification_count;
+	}
+	task->changed.notify_one();
+
+	return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+	xTaskNotifyGive(task);
+	if (higher_priority_task_woken != nullptr)
+		*higher_priority_task_woken = pdFALSE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+	auto *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> guard{task->lock};
+	auto notified = [task] { return task->notification_count != 0; };
+	if (ticks_to_wait == portMAX_DELAY)
+		task->changed.wait(guard, notified);
+	else
+		task->changed.wait_for(guard, std::chrono::milliseconds(ticks_to_wait), notified);
+
+	auto count = task->notification_count;
+	if (count != 0)
+		task->notification_count = clear_on_exit? 0 : count - 1;
+
+	return count;
+}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline void taskYIELD()
+{
+	std::this_thread::yield();
+}
+
+// task creation, declared only: the host tools run their tasks as threads of their own
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+									void *parameters, UBaseType_t priority, TaskHandle_t *created_task,
+									BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
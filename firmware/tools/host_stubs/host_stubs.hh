@@ -0,0 +1,63 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_STUBS
+#define HOST_STUBS
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+
+/**
+* @name host stubs
+*
+* @brief Host stand-ins for the ESP-IDF and FreeRTOS headers the player components include, for
+*        the host tools: a virtual clock the gptimers and esp_timer run on, and a hook on the GPIO
+*        register writes. C++ only, and header only: a tool includes them in a single translation
+*        unit, alike the player components' own headers.
+*/
+
+
+namespace host_stubs {
+
+// the virtual clock, in ns, while virtual_time is set; the host's steady clock otherwise
+inline bool virtual_time = false;
+inline int64_t now_ns = 0;
+
+inline int64_t time_us()
+{
+	if (virtual_time)
+		return now_ns / 1000;
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// REG_WRITE(reg, value) lands here; no-op unless set
+inline std::function<void(uint32_t, uint32_t)> reg_write_hook{};
+
+inline void reg_write(uint32_t reg, uint32_t value)
+{
+	if (reg_write_hook)
+		reg_write_hook(reg, value);
+}
+
+// moves the virtual clock to ns, firing the alarms of the running gptimers due on the way, in order
+inline void run_until(int64_t ns);
+
+};  // namespace host_stubs
+
+#endif // HOST_STUBS
@@ -0,0 +1,26 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "host_stubs.hh"
+
+// the ESP32 addresses, as register ids
+#define GPIO_OUT_REG 0x3ff44004
+#define GPIO_OUT_W1TS_REG 0x3ff44008
+#define GPIO_OUT_W1TC_REG 0x3ff4400c
+
+#define REG_WRITE(reg, value) host_stubs::reg_write((uint32_t)(reg), (uint32_t)(value))
@@ -0,0 +1,124 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <library_index.hh>
+#include <wav_tags.hh>
+
+/**
+* @name library_index
+*
+* @brief Host tool: builds the player's library index from a mounted card, or a copy of it, and
+*        lists the content of an index.
+*
+*   library_index build <card root> [index file]    default index file: <card root>/.library.idx
+*   library_index dump <index file>
+*/
+
+
+namespace fs = std::filesystem;
+
+
+int build(const fs::path &root, const fs::path &index_path)
+{
+	library::index_builder builder{};
+	auto options = fs::directory_options::skip_permission_denied;
+	for (auto it = fs::recursive_directory_iterator{root, options}; it != fs::recursive_directory_iterator{}; ++it) {
+		auto name = it->path().filename().string();
+		if (name[0] == '.') {
+			if (it->is_directory())
+				it.disable_recursion_pending();
+			continue;
+		}
+
+		if (!it->is_regular_file() || !library::is_track_file(name))
+			continue;
+
+		std::ifstream file_istream{it->path(), std::ios::binary};
+		library::flac_tags tags{};
+		if (!library::read_track_tags(file_istream, tags)) {
+			std::cerr << "skipped: " << it->path().string() << std::endl;
+			continue;
+		}
+
+		// the player's paths: from the card root, '/' separated
+		builder.add("/" + fs::relative(it->path(), root).generic_string(), tags);
+	}
+
+	auto *file = ::fopen(index_path.string().c_str(), "wb");
+	if (file == nullptr) {
+		std::cerr << "cannot write " << index_path.string() << std::endl;
+		return 1;
+	}
+	builder.write(file);
+	::fclose(file);
+
+	std::cout << "indexed " << builder.size() << " tracks into " << index_path.string() << std::endl;
+	return 0;
+}
+
+
+int dump(const fs::path &index_path)
+{
+	library::index_reader index{index_path.string().c_str()};
+	auto &header = index.header();
+
+	for (uint32_t i = 0; i < header.artist_count; ++i) {
+		auto artist = index.artist(i);
+		std::cout << index.string(artist.name) << "\n";
+
+		for (auto j = artist.first_album; j < artist.first_album + artist.album_count; ++j) {
+			auto album = index.album(j);
+			std::cout << "  " << index.string(album.name) << "\n";
+
+			for (auto k = album.first_track; k < album.first_track + album.track_count; ++k) {
+				auto track = index.track(k);
+				std::cout << "    " << track.number << ". " << index.string(track.title)
+							<< " [" << track.seconds / 60 << ":" << (track.seconds % 60 < 10? "0" : "") << track.seconds % 60
+							<< ", " << track.sample_rate << "Hz/" << (int)track.sample_bit_size << "bit/"
+							<< (int)track.channel_count << "ch] " << index.string(track.path) << "\n";
+			}
+		}
+	}
+	std::cout << header.artist_count << " artists, " << header.album_count << " albums, "
+				<< header.track_count << " tracks" << std::endl;
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	try {
+		if ((argc >= 3) && (std::string{argv[1]} == "build"))
+			return build(argv[2], (argc >= 4)? fs::path{argv[3]} : fs::path{argv[2]} / ".library.idx");
+		if ((argc == 3) && (std::string{argv[1]} == "dump"))
+			return dump(argv[2]);
+	} catch (const std::exception &e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cerr << "usage: " << argv[0] << " build <card root> [index file]\n"
+				<< "       " << argv[0] << " dump <index file>" << std::endl;
+	return 2;
+}
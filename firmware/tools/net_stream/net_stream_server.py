@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+#
+# esp32-audio-player - yet another esp32 audio player
+#
+# This library is free software: you can redistribute it and/or modify it under the terms of the
+# GNU General Public License as published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with this program.
+# If not, see <https://www.gnu.org/licenses/>.
+
+"""Host tool: serves a FLAC, WAVE or raw PCM file to the player's network input, paced in real time.
+
+Each client that connects gets the stream from its start. Raw PCM goes out behind a WAVE header of
+unknown data size. The pace can be skewed by some ppm, to stand for a sender clock off the player's,
+and the sends delayed at random, to stand for network jitter.
+
+  net_stream_server.py <file> [--port 8765] [--raw <rate>:<bits>:<channels>] [--drift-ppm 0]
+                       [--jitter-ms 0] [--prefill-ms 300] [--loop]
+
+and on the player:  GET /stream?host=<this host>&port=8765
+"""
+
+import argparse
+import random
+import socket
+import socketserver
+import struct
+import time
+
+CHUNK_MS = 20
+
+
+def wav_head(rate, bits, channels):
+    """The canonical header of a PCM stream of unknown size."""
+    container = (bits + 7) // 8
+    block_align = channels * container
+    return (b"RIFF" + struct.pack("<I", 0xffffffff) + b"WAVE"
+            + b"fmt " + struct.pack("<IHHIIHH", 16, 1, channels, rate, rate * block_align, block_align,
+                                    container * 8)
+            + b"data" + struct.pack("<I", 0xffffffff))
+
+
+def wav_byte_rate(data):
+    """Bytes/second of a RIFF/WAVE file, from its fmt chunk."""
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, size = data[pos:pos + 4], struct.unpack("<I", data[pos + 4:pos + 8])[0]
+        if chunk_id == b"fmt ":
+            return struct.unpack("<I", data[pos + 16:pos + 20])[0]
+        pos += 8 + size + (size & 1)
+    raise ValueError("no fmt chunk")
+
+
+def flac_byte_rate(data):
+    """Mean bytes/second of a FLAC file, from its size and the duration STREAMINFO gives."""
+    info = data[8:8 + 34]
+    rate = info[10] << 12 | info[11] << 4 | info[12] >> 4
+    samples = (info[13] & 0x0f) << 32 | struct.unpack(">I", info[14:18])[0]
+    if (rate == 0) or (samples == 0):
+        raise ValueError("no stream duration in STREAMINFO")
+    return len(data) * rate / samples
+
+
+def load(args):
+    """The stream bytes and their nominal rate, bytes/second."""
+    with open(args.file, "rb") as file:
+        data = file.read()
+
+    if args.raw:
+        rate, bits, channels = (int(value) for value in args.raw.split(":"))
+        return wav_head(rate, bits, channels) + data, rate * channels * ((bits + 7) // 8)
+    if data[:4] == b"RIFF":
+        return data, wav_byte_rate(data)
+    if data[:4] == b"fLaC":
+        return data, flac_byte_rate(data)
+    raise ValueError("neither FLAC nor WAVE; raw PCM takes --raw")
+
+
+class StreamHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        args, data, byte_rate = self.server.args, self.server.data, self.server.byte_rate
+        byte_rate *= 1 + args.drift_ppm * 1e-6
+        chunk_size = max(1, int(byte_rate * CHUNK_MS / 1000))
+        prefill = int(byte_rate * args.prefill_ms / 1000)
+        print(f"{self.client_address[0]}: streaming {len(data)} bytes at {byte_rate:.0f} bytes/s")
+
+        start = time.monotonic()
+        sent = 0
+        try:
+            while True:
+                while sent < len(data):
+                    # on schedule, or late by the simulated jitter; the head start fills the jitter buffer
+                    due = start + max(sent - prefill, 0) / byte_rate
+                    delay = due - time.monotonic() + random.uniform(0, args.jitter_ms / 1000)
+                    if delay > 0:
+                        time.sleep(delay)
+                    self.request.sendall(data[sent:sent + chunk_size])
+                    sent += chunk_size
+                if not args.loop:
+                    break
+                start += len(data) / byte_rate
+                prefill = sent = 0
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+        print(f"{self.client_address[0]}: done after {time.monotonic() - start:.1f}s")
+
+
+class StreamServer(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file")
+    parser.add_argument("--port", type=int, default=8765)
+    parser.add_argument("--raw", metavar="RATE:BITS:CHANNELS", help="the file is headerless PCM")
+    parser.add_argument("--drift-ppm", type=float, default=0, help="sender clock skew")
+    parser.add_argument("--jitter-ms", type=float, default=0, help="random delay added to each send")
+    parser.add_argument("--prefill-ms", type=float, default=300, help="head start of the stream")
+    parser.add_argument("--loop", action="store_true")
+    args = parser.parse_args()
+
+    with StreamServer(("", args.port), StreamHandler) as server:
+        server.args = args
+        server.data, server.byte_rate = load(args)
+        print(f"serving {args.file} on port {args.port}")
+        server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
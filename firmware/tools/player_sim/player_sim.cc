@@ -0,0 +1,491 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <player.hh>
+#include <stream_buffer.hh>
+#include <wav_decoder.hh>
+
+/**
+* @name player_sim
+*
+* @brief Host tool: runs the player's output path - the real stereo_player, its sample ring, the
+*        gptimer_clock and the dac_gpio register writes - on a virtual clock, fed by a model of the
+*        decoder task and of the SD card read ahead, and reports the buffer underruns.
+*
+*   player_sim [options]
+*     --seconds <s>           played time, default 10
+*     --rate <Hz>             sample rate, default 44100
+*     --decode-load <permil>  decoder time per sample, in 1/1000 of the sample period; default 400
+*     --bytes-per-sample <b>  compressed bytes per stereo sample, default 2.8 (16 bit FLAC)
+*     --frame <samples>       samples per decoded frame, default 4096
+*     --wav <samples>         pass back to back 16 bit stereo WAVE tracks of so many samples
+*     --sd <model>            SD latency of each 4kB read:
+*                               fixed:<us>                      default fixed:2000
+*                               spikes:<us>:<every>:<spike us>  a slow read every so many
+*                               random:<us>:<max us>[:<seed>]   uniform between the two
+*                               trace:<file>                    one latency (us) per line, looped
+*     --find-headroom         search the highest decode load that plays without underruns
+*     --max-underruns <n>     fail with more underruns than that
+*     --min-underruns <n>     fail with fewer underruns than that, default 0
+*
+* The decoder reads a frame's worth of bytes from the read ahead, spends its decode time, and then
+* writes the frame into the ring, waiting alike wait_space() while it is full. The read ahead
+* refills its blocks one at a time, each read taking the SD model's latency. The two run
+* concurrently, as they do on their own cores. A model of the two PCM56 shift registers records
+* what the DAC latches, and when: the decoded samples must come out in order, none lost or
+* repeated, and the gaps between them must be the underruns the player reports, sample for sample.
+*
+* With --wav the frames are read from in memory WAVE tracks through wav_decoder::pass(), straight
+* into the ring alike pass_track: a track ending within a put_block() writes short, and the next
+* one follows on. The sequence runs on across the tracks, so that anything written at a boundary
+* that is not a sample of either track is told apart from them.
+*/
+
+
+// alike main.cc
+static const uint16_t buffer_slot_size = 512;
+static const uint8_t buffer_slot_count = 8;
+static const size_t read_ahead_block_size = 4096;
+static const size_t read_ahead_block_count = 6;
+
+static const auto sim_config = stereo_player_config {
+	.clk_gpio      = 14,
+	.ch1_data_gpio = 26,
+	.ch2_data_gpio = 25,
+	.le_gpio       = 27
+};
+
+using player_buffer_type = stream_buffer<encoded_sample_type, buffer_slot_size, buffer_slot_count>;
+using player_type = stereo_player<player_buffer_type>;
+using wav_decoder_type = pcm56_player::wav_decoder<std::istream, int32_t, 4096>;
+
+static const int64_t never = INT64_MAX;
+
+
+struct sim_options {
+	double seconds{10};
+	size_t sample_rate{44100};
+	uint32_t decode_load{400};
+	double bytes_per_sample{2.8};
+	size_t frame_size{4096};
+	size_t wav_track_size{0};
+	std::string sd_model{"fixed:2000"};
+	bool find_headroom{false};
+	int64_t max_underruns{-1};
+	int64_t min_underruns{0};
+};
+
+
+struct sim_result {
+	uint32_t underrun_count;
+	uint32_t concealed_count;
+	uint32_t worst_gap;
+	size_t latched_count;
+	size_t matched_count;
+	size_t gap_count;       // runs of other samples, or none, between decoded ones
+	size_t gap_samples;
+	size_t decoded_count;
+	size_t buffered_count;  // left in the ring at the end
+	size_t min_buffered;    // since the first frame was written
+	size_t wav_tracks;      // started, with --wav
+};
+
+
+/**
+* @brief SD read latencies, in ns, by the model's spec.
+*/
+class sd_latency {
+public:
+	explicit sd_latency(const std::string &spec)
+		: _kind{spec.substr(0, spec.find(':'))}, _values{}, _index{0}, _random{1}
+	{
+		auto rest = (spec.find(':') == std::string::npos)? std::string{} : spec.substr(spec.find(':') + 1);
+		if (_kind == "trace") {
+			std::ifstream trace{rest};
+			if (!trace)
+				throw std::runtime_error("player_sim: failed opening the trace '" + rest + "'");
+			for (double value; trace >> value;)
+				_values.push_back(value);
+			if (_values.empty())
+				throw std::runtime_error("player_sim: empty trace '" + rest + "'");
+			return;
+		}
+
+		for (size_t pos = 0; !rest.empty() && (pos != std::string::npos);) {
+			auto next = rest.find(':', pos);
+			_values.push_back(std::stod(rest.substr(pos, next - pos)));
+			pos = (next == std::string::npos)? next : next + 1;
+		}
+		if (((_kind == "fixed") && (_values.size() == 1))
+				|| ((_kind == "spikes") && (_values.size() == 3))
+				|| ((_kind == "random") && (_values.size() >= 2) && (_values.size() <= 3))) {
+			if (_kind == "random")
+				_random.seed((_values.size() == 3)? (uint32_t)_values[2] : 1);
+			return;
+		}
+		throw std::runtime_error("player_sim: bad SD model '" + spec + "'");
+	}
+
+	int64_t next()
+	{
+		double us = _values[0];
+		if (_kind == "spikes")
+			us = (++_index % (size_t)_values[1] == 0)? _values[2] : _values[0];
+		else if (_kind == "random")
+			us = std::uniform_real_distribution<double>{_values[0], _values[1]}(_random);
+		else if (_kind == "trace")
+			us = _values[_index++ % _values.size()];
+
+		return (int64_t)(us * 1000);
+	}
+
+private:
+	std::string _kind;
+	std::vector<double> _values;
+	size_t _index;
+	std::mt19937 _random;
+};
+
+
+/**
+* @brief The two PCM56 serial inputs, as driven through the GPIO set/clear registers: the data
+*        bits are shifted in on the rising CLK edges and the word latched on the falling LE edge,
+*        at the virtual time of the write.
+*/
+class pcm56_pair {
+public:
+	explicit pcm56_pair(const stereo_player_config &config)
+		: _clk{1u << config.clk_gpio}, _ch1{1u << config.ch1_data_gpio}, _ch2{1u << config.ch2_data_gpio},
+		  _le{1u << config.le_gpio}, _out{0}, _shift_1{0}, _shift_2{0}, latched{}
+	{}
+
+	void write(uint32_t reg, uint32_t value)
+	{
+		auto before = _out;
+		if (reg == GPIO_OUT_W1TS_REG)
+			_out |= value;
+		else if (reg == GPIO_OUT_W1TC_REG)
+			_out &= ~value;
+
+		if (!(before & _clk) && (_out & _clk)) {
+			_shift_1 = (uint16_t)((_shift_1 << 1) | ((_out & _ch1)? 1 : 0));
+			_shift_2 = (uint16_t)((_shift_2 << 1) | ((_out & _ch2)? 1 : 0));
+		}
+		if ((before & _le) && !(_out & _le))
+			latched.push_back({{(int16_t)_shift_1, (int16_t)_shift_2}, host_stubs::now_ns});
+	}
+
+private:
+	uint32_t _clk;
+	uint32_t _ch1;
+	uint32_t _ch2;
+	uint32_t _le;
+	uint32_t _out;
+	uint16_t _shift_1;
+	uint16_t _shift_2;
+
+public:
+	struct latch {
+		stereo_sample_type sample;
+		int64_t ns;
+	};
+
+	std::vector<latch> latched;
+};
+
+
+// the n-th decoded sample: distinct over a long run, and never near the silence a fade out ends in
+static stereo_sample_type sim_sample(size_t n)
+{
+	return {(int16_t)(0x4000 | (n & 0x3fff)), (int16_t)(-0x4000 - (int16_t)((n >> 14) & 0x3fff))};
+}
+
+
+// the WAVE track holding the decoded samples from first on
+static std::string wav_track(size_t first, size_t sample_count, size_t sample_rate)
+{
+	auto format = library::wav_format{};
+	format.sample_rate = (uint32_t)sample_rate;
+	format.channel_count = 2;
+	format.sample_bit_size = 16;
+	format.container_size = 2;
+	format.block_align = 4;
+
+	char head[pcm56_player::wav_head_size];
+	pcm56_player::make_wav_head(format, sample_count, head);
+	auto track = std::string{head, sizeof(head)};
+	for (size_t n = first; n < first + sample_count; ++n) {
+		auto sample = sim_sample(n);
+		for (auto value : {(uint16_t)sample.channel_0, (uint16_t)sample.channel_1})
+			track.append({(char)(value & 0xff), (char)(value >> 8)});
+	}
+
+	return track;
+}
+
+
+sim_result simulate(const sim_options &options, bool verbose)
+{
+	host_stubs::virtual_time = true;
+	host_stubs::now_ns = 0;
+
+	pcm56_pair dac{sim_config};
+	host_stubs::reg_write_hook = [&dac](uint32_t reg, uint32_t value) { dac.write(reg, value); };
+
+	sd_latency sd{options.sd_model};
+	auto sample_period_ns = 1e9 / options.sample_rate;
+	auto end_ns = (int64_t)(options.seconds * 1e9);
+	auto frame_bytes = (size_t)(options.frame_size * options.bytes_per_sample);
+	auto frame_ns = (int64_t)(options.frame_size * sample_period_ns * options.decode_load / 1000);
+
+	auto buffer = std::make_unique<player_buffer_type>();
+	player_stats stats{};
+	sim_result result{};
+	result.min_buffered = player_buffer_type::capacity;
+	{
+		player_type player{sim_config, *buffer, stats, options.sample_rate};
+
+		// read ahead: whole blocks filled, and the one being read
+		size_t filled_bytes = 0;
+		int64_t read_done = sd.next();
+
+		// decoder: waiting on the read ahead, decoding until decode_done, or writing out the frame
+		enum { need_input, decoding, writing } decoder = need_input;
+		int64_t decoder_ready = 0;
+		int64_t decode_done = never;
+		size_t frame_left = 0;
+
+		// --wav: the track being passed, at unity gain
+		std::istringstream wav_input{};
+		std::unique_ptr<wav_decoder_type> wav{};
+		auto next_track = [&] () {
+			wav_input.str(wav_track(result.decoded_count, options.wav_track_size, options.sample_rate));
+			wav_input.clear();
+			wav = std::make_unique<wav_decoder_type>(wav_input);
+			wav->decode_metadata();
+			++result.wav_tracks;
+		};
+		if (options.wav_track_size != 0)
+			next_track();
+
+		while (host_stubs::now_ns < end_ns) {
+			auto next = std::min({end_ns, read_done, decoder_ready, decode_done});
+			host_stubs::run_until(next);
+			if (result.decoded_count != 0)
+				result.min_buffered = std::min(result.min_buffered, buffer->size());
+
+			if (host_stubs::now_ns >= read_done) {
+				filled_bytes += read_ahead_block_size;
+				read_done = (filled_bytes + read_ahead_block_size <= read_ahead_block_size * read_ahead_block_count)?
+								host_stubs::now_ns + sd.next() : never;
+			}
+
+			if ((decoder == need_input) && (filled_bytes >= frame_bytes)) {
+				filled_bytes -= frame_bytes;
+				if (read_done == never)
+					read_done = host_stubs::now_ns + sd.next();  // a block was freed
+				decoder = decoding;
+				decode_done = host_stubs::now_ns + frame_ns;
+				decoder_ready = never;
+			} else if (decoder == need_input) {
+				decoder_ready = never;  // woken by the next read
+			}
+
+			if ((decoder == decoding) && (host_stubs::now_ns >= decode_done)) {
+				decoder = writing;
+				decode_done = never;
+				decoder_ready = host_stubs::now_ns;
+				frame_left = options.frame_size;
+			}
+
+			if ((decoder == writing) && (host_stubs::now_ns >= decoder_ready)) {
+				auto track_ended = false;
+				if (options.wav_track_size != 0) {
+					auto ramp = gain_ramp{volume_gain(0), volume_gain(0), frame_left};
+					auto written = buffer->put_block(frame_left, [&wav, &ramp](encoded_sample_type *data, size_t count) {
+						return wav->pass(data, count, ramp);
+					});
+					result.decoded_count += written;
+					frame_left -= written;
+					if (wav->complete()) {
+						next_track();
+						track_ended = true;
+					}
+				} else {
+					frame_left -= buffer->put_block(frame_left, [&result](encoded_sample_type *data, size_t count) {
+						for (size_t i = 0; i < count; ++i)
+							data[i] = pcm56_encoding::encode(sim_sample(result.decoded_count++));
+					});
+				}
+				if (frame_left == 0) {
+					decoder = need_input;
+					decoder_ready = host_stubs::now_ns;
+				} else if (track_ended) {
+					decoder_ready = host_stubs::now_ns;  // the next track goes on in the room left
+				} else {
+					// wait_space(): woken once a whole slot is free
+					auto missing = buffer_slot_size - std::min<size_t>(buffer->available(), buffer_slot_size);
+					decoder_ready = host_stubs::now_ns + (int64_t)((missing + 1) * sample_period_ns);
+				}
+			}
+			if ((decoder == need_input) && (decoder_ready == never) && (filled_bytes >= frame_bytes))
+				decoder_ready = host_stubs::now_ns;
+		}
+		result.buffered_count = buffer->size();
+	}
+	host_stubs::reg_write_hook = nullptr;
+
+	result.underrun_count = stats.underrun_count.load();
+	result.concealed_count = stats.concealed_count.load();
+	result.worst_gap = stats.worst_gap.load();
+
+	// the gaps before the first decoded sample and after the last one are not underruns
+	result.latched_count = dac.latched.size();
+	size_t gap = 0;
+	auto last_ns = never;
+	for (const auto &[sample, ns] : dac.latched) {
+		// sample periods without a latch, the DAC holding its output, are part of the gap
+		if (last_ns != never)
+			gap += (size_t)std::llround((ns - last_ns) / sample_period_ns) - 1;
+		last_ns = ns;
+
+		auto expected = sim_sample(result.matched_count);
+		if ((sample.channel_0 != expected.channel_0) || (sample.channel_1 != expected.channel_1)) {
+			++gap;
+			continue;
+		}
+		if ((gap != 0) && (result.matched_count != 0)) {
+			++result.gap_count;
+			result.gap_samples += gap;
+		}
+		gap = 0;
+		++result.matched_count;
+	}
+
+	if (verbose)
+		printf("%zu samples latched, %zu of %zu decoded samples in order, %zu left in the ring, "
+				"%u underruns, %u samples concealed, worst gap %u samples, lowest fill %zu/%zu\n",
+				result.latched_count, result.matched_count, result.decoded_count, result.buffered_count,
+				result.underrun_count, result.concealed_count, result.worst_gap, result.min_buffered,
+				player_buffer_type::capacity);
+	if (verbose && (options.wav_track_size != 0))
+		printf("%zu WAVE tracks of %zu samples started\n", result.wav_tracks, options.wav_track_size);
+
+	return result;
+}
+
+
+bool parse(int argc, char *argv[], sim_options &options)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg{argv[i]};
+		if (arg == "--find-headroom") {
+			options.find_headroom = true;
+			continue;
+		}
+		if (i + 1 == argc)
+			return false;
+
+		std::string value{argv[++i]};
+		if (arg == "--seconds")
+			options.seconds = std::stod(value);
+		else if (arg == "--rate")
+			options.sample_rate = std::stoul(value);
+		else if (arg == "--decode-load")
+			options.decode_load = std::stoul(value);
+		else if (arg == "--bytes-per-sample")
+			options.bytes_per_sample = std::stod(value);
+		else if (arg == "--frame")
+			options.frame_size = std::stoul(value);
+		else if (arg == "--wav")
+			options.wav_track_size = std::stoul(value);
+		else if (arg == "--sd")
+			options.sd_model = value;
+		else if (arg == "--max-underruns")
+			options.max_underruns = std::stol(value);
+		else if (arg == "--min-underruns")
+			options.min_underruns = std::stol(value);
+		else
+			return false;
+	}
+
+	return (options.sample_rate != 0) && (options.frame_size != 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+	sim_options options{};
+	if (!parse(argc, argv, options)) {
+		std::cerr << "usage: player_sim [--seconds s] [--rate Hz] [--decode-load permil] [--bytes-per-sample b]\n"
+					"                  [--frame samples] [--wav samples] [--sd fixed:us|spikes:us:every:us|random:us:us[:seed]|trace:file]\n"
+					"                  [--find-headroom] [--max-underruns n] [--min-underruns n]" << std::endl;
+		return 2;
+	}
+
+	try {
+		if (options.find_headroom) {
+			// the highest decode load, in permil, that plays without underruns
+			uint32_t low = 0, high = 1000;
+			while (low < high) {
+				options.decode_load = (low + high + 1) / 2;
+				if (simulate(options, false).underrun_count == 0)
+					low = options.decode_load;
+				else
+					high = options.decode_load - 1;
+			}
+			printf("headroom: decode load up to %u permil of the sample period, with SD %s\n", low,
+					options.sd_model.c_str());
+			return 0;
+		}
+
+		auto result = simulate(options, true);
+		// every decoded sample latched once and in order, or still in the ring, and the other samples
+		// latched where the player reported underruns
+		if ((result.matched_count + result.buffered_count != result.decoded_count)
+				|| (result.gap_count != result.underrun_count) || (result.gap_samples != result.concealed_count)) {
+			std::cerr << "error: the DAC output is not the decoded sequence" << std::endl;
+			return 1;
+		}
+		if ((options.wav_track_size != 0) && (result.wav_tracks < 3)) {
+			std::cerr << "error: no WAVE track boundary played" << std::endl;
+			return 1;
+		}
+		if (((options.max_underruns >= 0) && (result.underrun_count > options.max_underruns))
+				|| (result.underrun_count < options.min_underruns)) {
+			std::cerr << "error: " << result.underrun_count << " underruns" << std::endl;
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
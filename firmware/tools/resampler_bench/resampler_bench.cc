@@ -0,0 +1,220 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <player.hh>
+#include <resampler.hh>
+
+/**
+* @name resampler_bench
+*
+* @brief Host tool: measures the polyphase resampler, for each source rate the player converts, on
+*        a sweep of -6dBFS tones: the passband gain ripple, the spurious output (images, aliases,
+*        coefficient and rounding error) of the passband tones, the stopband attenuation of the
+*        tones that would alias into the passband, and the throughput.
+*
+*   resampler_bench [passband edge Hz]    default 18000, and at most 0.35 of the lower rate
+*
+* A tone's output is fit with a sinusoid at its frequency (least squares); the fit is its gain, the
+* rest of the output is spurious. Tones above the output Nyquist frequency have no fit, all of
+* their output is aliasing: the stopband starts where the aliases land above the passband edge.
+* The throughput is of stereo output samples, in 4096 sample source blocks, and is a host figure.
+*/
+
+
+using source_type = int32_t;  // FLAC decoder samples, as main's flac_sample_type
+using resampler_type = polyphase_resampler<source_type>;
+
+static const size_t bench_block_size = 4096;
+static const size_t settle_count = 256;      // output samples left out of the fit
+static const size_t fit_count = 16384;
+static const uint8_t tone_bit_size = 24;     // a noise floor well below the filter's
+static const double tone_level = 0.5;        // of the full scale
+
+
+// the resampler's output for the source, in decoder sized blocks, alike decode_track
+std::vector<source_type> convert(resampler_type &resampler, const std::vector<source_type> &source)
+{
+	std::vector<source_type> output{};
+	for (size_t block = 0; block < source.size(); block += bench_block_size) {
+		auto block_size = std::min(bench_block_size, source.size() - block);
+		const source_type *channels[] = {&source[block], &source[block]};
+		size_t input_pos = 0;
+		auto count = resampler.output_count(block_size);
+		for (size_t done = 0; done < count; ) {
+			auto chunk = std::min(count - done, resampler.chunk_size);
+			resampler.run(channels, input_pos, chunk);
+			output.insert(output.end(), resampler.output()[0], resampler.output()[0] + chunk);
+			done += chunk;
+		}
+		resampler.absorb(channels, input_pos, block_size);
+	}
+
+	return output;
+}
+
+
+struct tone_response {
+	double gain_db;      // of the fit sinusoid
+	double spurious_db;  // the rest, against the tone's level
+};
+
+
+tone_response measure(resampler_type &resampler, size_t input_rate, size_t output_rate, double frequency)
+{
+	auto peak = tone_level * ((1 << (tone_bit_size - 1)) - 1);
+	auto input_count = (settle_count + fit_count + 64) * input_rate / output_rate + 1;
+	std::vector<source_type> source(input_count);
+	for (size_t n = 0; n < input_count; ++n)
+		source[n] = (source_type)lround(peak * sin(2 * M_PI * frequency * n / input_rate));
+
+	resampler.reset();
+	auto output = convert(resampler, source);
+	if (output.size() < settle_count + fit_count)
+		throw std::runtime_error("resampler_bench: short output");
+
+	// least squares fit of a c cos + b sin + d, on the normal equations
+	auto omega = 2 * M_PI * frequency / output_rate;
+	double m[3][4]{};
+	auto power = 0.0;
+	for (size_t i = 0; i < fit_count; ++i) {
+		auto y = (double)output[settle_count + i];
+		double basis[3] = {cos(omega * i), sin(omega * i), 1};
+		if (frequency * 2 >= output_rate)
+			basis[0] = basis[1] = 0;
+		for (int r = 0; r < 3; ++r) {
+			for (int c = 0; c < 3; ++c)
+				m[r][c] += basis[r] * basis[c];
+			m[r][3] += basis[r] * y;
+		}
+		power += y * y;
+	}
+	double fit[3]{};
+	if (frequency * 2 < output_rate) {
+		// Gauss-Jordan, the matrix is well conditioned over this many periods
+		for (int p = 0; p < 3; ++p)
+			for (int r = 0; r < 3; ++r)
+				if (r != p) {
+					auto factor = m[r][p] / m[p][p];
+					for (int c = p; c < 4; ++c)
+						m[r][c] -= factor * m[p][c];
+				}
+		for (int r = 0; r < 3; ++r)
+			fit[r] = m[r][3] / m[r][r];
+	} else {
+		fit[2] = m[2][3] / m[2][2];
+	}
+
+	auto residual = 0.0;
+	for (size_t i = 0; i < fit_count; ++i) {
+		auto y = (double)output[settle_count + i];
+		auto e = y - fit[0] * cos(omega * i) - fit[1] * sin(omega * i) - fit[2];
+		residual += e * e;
+	}
+	(void)power;
+
+	auto amplitude = std::hypot(fit[0], fit[1]);
+	auto tone_power = peak * peak / 2 * fit_count;
+
+	return {20 * log10(std::max(amplitude, 1e-9) / peak), 10 * log10(std::max(residual, 1e-9) / tone_power)};
+}
+
+
+double throughput(resampler_type &resampler, size_t input_rate, size_t output_rate, uint8_t sample_bit_size)
+{
+	std::mt19937 random{1};
+	std::uniform_int_distribution<source_type> value{-(1 << (sample_bit_size - 1)), (1 << (sample_bit_size - 1)) - 1};
+	std::vector<source_type> source[2];
+	for (auto &channel : source) {
+		channel.resize(bench_block_size);
+		for (auto &sample : channel)
+			sample = value(random);
+	}
+	const source_type *channels[] = {source[0].data(), source[1].data()};
+
+	resampler.configure(input_rate, output_rate, 2, sample_bit_size);
+	size_t output_total = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = std::chrono::duration<double>{0};
+	do {
+		size_t input_pos = 0;
+		auto count = resampler.output_count(bench_block_size);
+		for (size_t done = 0; done < count; ) {
+			auto chunk = std::min(count - done, resampler.chunk_size);
+			resampler.run(channels, input_pos, chunk);
+			done += chunk;
+		}
+		resampler.absorb(channels, input_pos, bench_block_size);
+		output_total += count;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < 0.2);
+
+	return output_total / elapsed.count();
+}
+
+
+int main(int argc, char *argv[])
+{
+	double passband_edge = (argc > 1)? std::stod(argv[1]) : 18000;
+	auto resampler = std::make_unique<resampler_type>();
+	auto output_rate = player_sample_rate;
+
+	printf("to %zu Hz, passband up to %.0f Hz, -6dBFS %u bit tones\n", output_rate, passband_edge, tone_bit_size);
+	printf("%8s %6s %10s %10s %10s %12s %12s %12s %12s %12s\n", "source", "taps", "passband", "ripple dB", "-3dB at",
+			"spurious dB", "at 1kHz dB", "stopband dB", "16 bit Msps", "24 bit Msps");
+	for (size_t input_rate : {22050, 32000, 44100, 48000, 88200, 96000}) {
+		resampler->configure(input_rate, output_rate, 1, tone_bit_size);
+
+		// short of the filter's transition band, which starts at ~0.4 of the lower rate
+		auto edge = std::min(passband_edge, 0.35 * std::min(input_rate, output_rate));
+		auto gain_min = 1e9, gain_max = -1e9, spurious_max = -1e9, stopband_max = -1e9, corner = 0.0;
+		auto spurious_1k = measure(*resampler, input_rate, output_rate, 1000).spurious_db;
+		for (auto frequency = 20.0; frequency < input_rate / 2.0; frequency *= pow(2, 1 / 24.0)) {
+			auto response = measure(*resampler, input_rate, output_rate, frequency);
+			if (frequency <= edge) {
+				gain_min = std::min(gain_min, response.gain_db);
+				gain_max = std::max(gain_max, response.gain_db);
+				spurious_max = std::max(spurious_max, response.spurious_db);
+			}
+			if ((corner == 0) && (frequency * 2 < output_rate) && (response.gain_db < -3))
+				corner = frequency;
+			// aliased at or above the passband edge
+			if (frequency >= output_rate - passband_edge)
+				stopband_max = std::max(stopband_max, response.spurious_db);
+		}
+
+		auto msps_16 = throughput(*resampler, input_rate, output_rate, 16) / 1e6;
+		auto msps_24 = throughput(*resampler, input_rate, output_rate, 24) / 1e6;
+		printf("%8zu %6zu %10.0f %10.3f %10.0f %12.1f %12.1f ", input_rate, resampler->taps(), edge, gain_max - gain_min, corner, spurious_max,
+				spurious_1k);
+		if (stopband_max > -1e9)
+			printf("%12.1f ", -stopband_max);
+		else
+			printf("%12s ", "-");
+		printf("%12.2f %12.2f\n", msps_16, msps_24);
+	}
+	printf("twice the taps in multiply-accumulates per output sample and channel; %zu phases, the two either side of"
+			" the output position interpolated\n", resampler_type::phase_count);
+
+	return 0;
+}
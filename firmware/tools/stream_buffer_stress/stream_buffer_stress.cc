@@ -0,0 +1,163 @@
+/* Copyright (C) 2024  Bogdan-Gabriel Alecu  (GameInstance.com)
+ *
+ * esp32-audio-player - yet another esp32 audio player
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <stream_buffer.hh>
+
+/**
+* @name stream_buffer_stress
+*
+* @brief Host tool: a producer and a consumer thread hammer a stream_buffer through all of its
+*        producer and consumer calls, and check that the values come out in order, none lost and
+*        none repeated, across many wraparounds of the ring.
+*
+*   stream_buffer_stress [values]    default: 20000000 values per ring
+*
+* The producer cycles through put(), put_span() and put_block() with varying lengths, the latter
+* also with a fill that runs dry short of its count, waiting in wait_space() when the ring is full. The consumer cycles through get() and peek()/consume(),
+* calling notify_space() after each. A wait that runs into its timeout while the consumer is busy
+* freeing space is a lost wake up, and fails the run alike a value out of order.
+*/
+
+
+using value_type = uint32_t;
+
+static const TickType_t wait_timeout_ms = 1000;
+
+
+struct stress_result {
+	size_t values;
+	size_t waits;
+	size_t lost_wake_ups;
+	size_t errors;
+};
+
+
+template<size_t SLOT_SIZE, size_t SLOT_COUNT>
+stress_result stress(size_t value_count)
+{
+	using buffer_type = stream_buffer<value_type, SLOT_SIZE, SLOT_COUNT>;
+	auto buffer = std::make_unique<buffer_type>();
+	stress_result result{value_count, 0, 0, 0};
+	std::atomic<size_t> consumer_errors{0};
+
+	std::thread consumer{[&buffer, &consumer_errors, value_count] {
+		value_type expected = 0;
+		for (size_t round = 0; expected != value_count; ++round) {
+			if (round % 3 == 0) {
+				auto value = buffer->template get<isr_operation>();
+				if (value && (*value != expected++))
+					++consumer_errors;
+				if (!value)
+					std::this_thread::yield();
+			} else {
+				// within the ring, up to its end; the rest on the next call
+				auto values = buffer->peek();
+				auto count = std::min(values.size(), 1 + round % (2 * SLOT_SIZE));
+				if (values.size() > buffer_type::capacity)
+					++consumer_errors;
+				for (size_t i = 0; i < count; ++i)
+					if (values[i] != expected++)
+						++consumer_errors;
+				buffer->consume(count);
+				if (count == 0)
+					std::this_thread::yield();
+			}
+			buffer->template notify_space<isr_operation>();
+		}
+	}};
+
+	std::vector<value_type> span(2 * SLOT_SIZE + 3);
+	value_type next = 0;
+	for (size_t round = 0; next != value_count; ++round) {
+		auto left = value_count - next;
+		if (round % 4 == 0) {
+			if (buffer->template put<task_operation>(next))
+				++next;
+		} else if (round % 4 == 1) {
+			auto count = std::min<size_t>(left, 1 + round % span.size());
+			for (size_t i = 0; i < count; ++i)
+				span[i] = next + i;
+			next += buffer->put_span({span.data(), count});
+		} else if (round % 4 == 2) {
+			auto count = std::min<size_t>(left, 1 + round % (3 * SLOT_SIZE));
+			next += buffer->put_block(count, [&next, written = size_t{0}](value_type *data, size_t size) mutable {
+				for (size_t i = 0; i < size; ++i)
+					data[i] = next + written++;
+			});
+		} else {
+			auto count = std::min<size_t>(left, 3 * SLOT_SIZE);
+			auto have = std::min<size_t>(count, 1 + round % (2 * SLOT_SIZE));  // then the source runs dry
+			next += buffer->put_block(count, [&next, &have, written = size_t{0}](value_type *data, size_t size) mutable {
+				size = std::min(size, have);
+				for (size_t i = 0; i < size; ++i)
+					data[i] = next + written++;
+				have -= size;
+
+				return size;
+			});
+		}
+
+		if (buffer->need_data() || (next == value_count))
+			continue;
+
+		++result.waits;
+		auto start = std::chrono::steady_clock::now();
+		auto ready = buffer->wait_space(wait_timeout_ms);
+		if (ready && (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(wait_timeout_ms)))
+			++result.lost_wake_ups;
+	}
+
+	consumer.join();
+	result.errors = consumer_errors.load();
+	if (buffer->size() != 0)
+		++result.errors;
+
+	printf("ring of %zu x %zu: %zu values, %zu producer waits, %zu lost wake ups, %zu errors\n",
+			SLOT_COUNT, SLOT_SIZE, result.values, result.waits, result.lost_wake_ups, result.errors);
+
+	return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t value_count = (argc > 1)? std::stoul(argv[1]) : 20000000;
+
+	// the player's ring, a tiny one for many more wraparounds, and two slots alike a ping-pong buffer
+	stress_result results[] = {
+		stress<512, 8>(value_count),
+		stress<4, 4>(value_count),
+		stress<64, 2>(value_count),
+	};
+
+	for (const auto &result : results)
+		if ((result.errors != 0) || (result.lost_wake_ups != 0)) {
+			std::cerr << "error: the ring lost, repeated or reordered values, or missed a wake up" << std::endl;
+			return 1;
+		}
+
+	return 0;
+}